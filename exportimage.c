@@ -0,0 +1,188 @@
+/* -*-C-*-
+ *******************************************************************************
+ *
+ * File:         exportimage.c
+ * Description:  Extracts the files of a Simple File System disk image to a host directory
+ * Language:     C
+ * Package:      N/A
+ * Status:       Experimental (Do Not Distribute)
+ *
+ *******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "sdisk.h"
+#include "sfs.h"
+
+#define MAXTHREAD	64
+
+sfs_imgent_t*	ents;// what the image holds, each dir before its entries
+char**		paths;// the host path of each of them, NULL for one that is not extracted
+int		numents;
+int		next;// the next entry a writer thread takes
+int		numfiles;// files written
+int		failed;// files that couldn't be written
+int		refused;// entries whose names would leave their dir, not counting what is beneath them
+
+/*
+ * usage: report usage to given stream and exit
+ *
+ * Parameters: Where to report usage and our exit status
+ *
+ * Returns: -
+ *
+ */
+void usage(char *program_name, FILE* stream, int status) {
+    fprintf(stream, "Usage: %s -h -t THREADS -f FILE -d DIR\n"
+        "Extract every file and directory of a simple file system disk image.\n"
+        "   -h \tthis help message\n"
+        "   -t THREADS \thow many threads write the host files (default: one per cpu)\n"
+        "   -f FILE \tdisk image file, it is not changed\n"
+        "   -d DIR \thost directory to extract to, it is created if needed\n"
+        "An entry named . or .. or with a / in its name is refused, with everything beneath it.\n"
+        "The exit status is 0 if everything was extracted, 1 otherwise.\n",
+        program_name);
+    exit(status);
+} /* !usage */
+
+/*
+ * badname: tell a name that would leave the dir it is joined to
+ *
+ * Parameters: the name of an entry
+ *
+ * Returns: 1 if it is empty, . or .., or has a / in it, 0 otherwise
+ */
+int badname(char* name) {
+    return name[0] == 0 || !strcmp(name, ".") || !strcmp(name, "..") || strchr(name, '/') != NULL;
+} /* !badname */
+
+/*
+ * writer: a writer thread, taking the next file until none is left
+ *
+ * Parameters: -
+ *
+ * Returns: NULL
+ */
+void* writer(void* arg) {
+    FILE* f;
+    int i, ok;
+
+    while ((i = __sync_fetch_and_add(&next, 1)) < numents) {
+        if (ents[i].type != 2 || paths[i] == NULL)
+            continue;
+        ok = (f = fopen(paths[i], "wb")) != NULL
+                && fwrite(ents[i].data, 1, ents[i].size, f) == ents[i].size;
+        if (f != NULL && fclose(f))
+            ok = 0;
+        if (ok) {
+            __sync_fetch_and_add(&numfiles, 1);
+        } else {
+            perror(paths[i]);
+            __sync_fetch_and_add(&failed, 1);
+        }
+    }
+    return NULL;
+} /* !writer */
+
+int main(int argc, char* argv[]) {
+    pthread_t thread[MAXTHREAD];
+    int c, i, numdirs = 0;
+    int numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    char* program_name = argv[0];
+    char* diskFName = NULL;
+    char* hostDir = NULL;
+
+    while ((c = getopt(argc, argv, "ht:f:d:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(program_name, stdout, 0);
+            break;
+        case 't':
+            numthreads = atoi(optarg);
+            break;
+        case 'f':
+            diskFName = optarg;
+            break;
+        case 'd':
+            hostDir = optarg;
+            break;
+        default:
+            usage(program_name, stderr, 1);
+            break;
+        }
+    }
+    if (diskFName == NULL || hostDir == NULL || numthreads < 1) {
+        usage(program_name, stderr, 1);
+    }
+    if (numthreads > MAXTHREAD)
+        numthreads = MAXTHREAD;
+
+    if (SD_initDisk() || SD_loadDisk(diskFName)) {
+        fprintf(stderr, "Error %d while reading disk image from %s\n", sderrno, diskFName);
+        return 1;
+    }
+    // the journal is replayed in memory only, the image file is never saved
+    if (sfs_mount()) {
+        fprintf(stderr, "%s holds no file system or its header is corrupt\n", diskFName);
+        return 1;
+    }
+    // every file is read at once, in the order of the sectors on the disk
+    if ((numents = sfs_readimage(&ents)) == -1) {
+        fprintf(stderr, "%s has a corrupt dir or sector, run sfsck on it\n", diskFName);
+        return 1;
+    }
+
+    // the dirs first, each after its parent
+    if ((paths = malloc(numents * sizeof(char*))) == NULL)
+        return 1;
+    paths[0] = hostDir;
+    for (i = 0; i < numents; ++i) {
+        if (i > 0 && (paths[ents[i].parent] == NULL || badname(ents[i].name))) {
+            if (paths[ents[i].parent] != NULL) {
+                fprintf(stderr, "%s: refusing the entry \"%s\"\n", paths[ents[i].parent], ents[i].name);
+                refused++;
+            }
+            paths[i] = NULL; // nor anything beneath it
+            continue;
+        }
+        if (i > 0) {
+            paths[i] = malloc(strlen(paths[ents[i].parent]) + strlen(ents[i].name) + 2);
+            if (paths[i] == NULL)
+                return 1;
+            sprintf(paths[i], "%s/%s", paths[ents[i].parent], ents[i].name);
+        }
+        if (ents[i].type != 1)
+            continue;
+        numdirs++;
+        if (mkdir(paths[i], 0777) && errno != EEXIST) {
+            perror(paths[i]);
+            return 1;
+        }
+    }
+
+    // then the files, by a pool of threads
+    for (i = 0; i < numthreads; ++i) {
+        if (pthread_create(&thread[i], NULL, writer, NULL)) {
+            fprintf(stderr, "Error while starting thread %d\n", i);
+            numthreads = i;
+            break;
+        }
+    }
+    writer(NULL); // in case no thread could be started
+    for (i = 0; i < numthreads; ++i) {
+        pthread_join(thread[i], NULL);
+    }
+    printf("%s: %d files and %d dirs", hostDir, numfiles, numdirs);
+    if (failed > 0)
+        printf(", %d files failed", failed);
+    if (refused > 0)
+        printf(", %d entries refused", refused);
+    printf("\n");
+    return (failed > 0 || refused > 0) ? 1 : 0;
+} /* !main */
@@ -0,0 +1,215 @@
+/* -*-C-*-
+ *******************************************************************************
+ *
+ * File:         mkimage.c
+ * Description:  Builds a Simple File System disk image from a host directory
+ * Language:     C
+ * Package:      N/A
+ * Status:       Experimental (Do Not Distribute)
+ *
+ *******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "sdisk.h"
+#include "sfs.h"
+
+sfs_imgent_t*	ents;// what goes in the image, each dir before its entries
+char**		paths;// the host path of each of them
+int		numents;
+int		maxents;
+long		total;// bytes of file data read so far
+
+/*
+ * usage: report usage to given stream and exit
+ *
+ * Parameters: Where to report usage and our exit status
+ *
+ * Returns: -
+ *
+ */
+void usage(char *program_name, FILE* stream, int status) {
+    fprintf(stream, "Usage: %s -h -z -d DIR -f FILE\n"
+        "Build a simple file system disk image holding a copy of a host directory tree.\n"
+        "   -h \tthis help message\n"
+        "   -z \tsave the image in the sparse, compressed format\n"
+        "   -d DIR \thost directory to copy, it becomes the root\n"
+        "   -f FILE \tdisk image file to write, it is replaced\n"
+        "Only regular files and directories are copied, names longer than 16 characters are skipped.\n"
+        "The exit status is 0 if the image was written, 1 otherwise.\n",
+        program_name);
+    exit(status);
+} /* !usage */
+
+/*
+ * add_entry: append a file or dir to ents
+ *
+ * Parameters: its name, the index of its dir, its type and its host path
+ *
+ * Returns: its index, or -1 if an error occurred
+ */
+int add_entry(char* name, int parent, int type, char* path) {
+    int newmax = (maxents == 0) ? 256 : 2 * maxents;
+    sfs_imgent_t* newents;
+    char** newpaths;
+
+    if (numents == maxents) {
+        // the old arrays are kept, still valid, if either can't grow
+        if ((newents = realloc(ents, newmax * sizeof(sfs_imgent_t))) == NULL)
+            return -1;
+        ents = newents;
+        if ((newpaths = realloc(paths, newmax * sizeof(char*))) == NULL)
+            return -1;
+        paths = newpaths;
+        maxents = newmax;
+    }
+    memset(&ents[numents], 0, sizeof(sfs_imgent_t));
+    strncpy(ents[numents].name, name, 16);
+    ents[numents].parent = parent;
+    ents[numents].type = type;
+    paths[numents] = path;
+    return numents++;
+} /* !add_entry */
+
+/*
+ * read_file: read the host file of an entry into its data
+ *
+ * Parameters: the index of the entry and the size of the file
+ *
+ * Returns: 0 on success, or -1 if an error occurred or it can't fit
+ */
+int read_file(int i, long size) {
+    FILE* f;
+
+    total += size;
+    if (total > (long)SD_NUMSECTORS * SD_SECTORSIZE) {
+        fprintf(stderr, "%s: the files don't fit in a disk of %d sectors\n", paths[i], SD_NUMSECTORS);
+        return -1;
+    }
+    ents[i].size = size;
+    if (size == 0)
+        return 0;
+    if ((ents[i].data = malloc(size)) == NULL || (f = fopen(paths[i], "rb")) == NULL) {
+        perror(paths[i]);
+        return -1;
+    }
+    if (fread(ents[i].data, 1, size, f) != size) {
+        fprintf(stderr, "%s: short read\n", paths[i]);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+} /* !read_file */
+
+/*
+ * add_dir: append every entry of a host dir, in name order, so the
+ *   files of a dir end up next to each other in the image
+ *
+ * Parameters: the index of the dir
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int add_dir(int d) {
+    struct dirent** list;
+    struct stat st;
+    char* path;
+    int i, n, e, type, hr = 0;
+
+    if ((n = scandir(paths[d], &list, NULL, alphasort)) < 0) {
+        perror(paths[d]);
+        return -1;
+    }
+    for (i = 0; i < n; ++i) {
+        if (hr == 0 && strcmp(list[i]->d_name, ".") && strcmp(list[i]->d_name, "..")) {
+            path = malloc(strlen(paths[d]) + strlen(list[i]->d_name) + 2);
+            if (path == NULL) {
+                hr = -1;
+            }
+            else if (sprintf(path, "%s/%s", paths[d], list[i]->d_name) < 0 || lstat(path, &st)) {
+                perror(path);
+                hr = -1;
+            }
+            else if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+                fprintf(stderr, "%s: skipped, not a regular file or directory\n", path);
+                free(path);
+            }
+            else if (strlen(list[i]->d_name) > 16) {
+                fprintf(stderr, "%s: skipped, the name is longer than 16 characters\n", path);
+                free(path);
+            }
+            else {
+                type = S_ISDIR(st.st_mode) ? 1 : 2;
+                if ((e = add_entry(list[i]->d_name, d, type, path)) == -1)
+                    hr = -1;
+                else if (type == 2 && read_file(e, st.st_size))
+                    hr = -1;
+            }
+        }
+        free(list[i]);
+    }
+    free(list);
+    return hr;
+} /* !add_dir */
+
+int main(int argc, char* argv[]) {
+    int c, i, numdirs = 0, compressed = 0;
+    char* program_name = argv[0];
+    char* diskFName = NULL;
+    char* hostDir = NULL;
+
+    while ((c = getopt(argc, argv, "hzd:f:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(program_name, stdout, 0);
+            break;
+        case 'z':
+            compressed = 1;
+            break;
+        case 'd':
+            hostDir = optarg;
+            break;
+        case 'f':
+            diskFName = optarg;
+            break;
+        default:
+            usage(program_name, stderr, 1);
+            break;
+        }
+    }
+    if (diskFName == NULL || hostDir == NULL) {
+        usage(program_name, stderr, 1);
+    }
+
+    // the whole tree first, dir by dir, each dir's entries together
+    if (add_entry("", 0, 1, hostDir) == -1)
+        return 1;
+    for (i = 0; i < numents; ++i) {
+        if (ents[i].type != 1)
+            continue;
+        numdirs++;
+        if (add_dir(i))
+            return 1;
+    }
+
+    // then the image, laid out and written in one go
+    if (SD_initDisk()) {
+        fprintf(stderr, "Error %d while initializing the disk\n", sderrno);
+        return 1;
+    }
+    if (sfs_mkimage(ents, numents)) {
+        fprintf(stderr, "%s doesn't fit in a disk of %d sectors\n", hostDir, SD_NUMSECTORS);
+        return 1;
+    }
+    if ((compressed) ? SD_saveDiskCompressed(diskFName) : SD_saveDisk(diskFName)) {
+        fprintf(stderr, "Error %d while saving disk image to %s\n", sderrno, diskFName);
+        return 1;
+    }
+    printf("%s: %d files and %d dirs, %ld bytes\n", diskFName, numents - numdirs, numdirs, total);
+    return 0;
+} /* !main */
@@ -48,8 +48,12 @@ extern SDError_t sderrno; /* to see what happen with disk op */
 extern int SD_initDisk();
 extern int SD_finalizeDisk();
 extern int SD_saveDisk(char* file);
+extern int SD_saveDiskIncremental(char* file);
+extern int SD_saveDiskCompressed(char* file);
 extern int SD_loadDisk(char* file);
 extern int SD_read(int sector, void *buf);
 extern int SD_write(int sector, void *buf);
+extern int SD_numDirty();
+extern long long SD_numReads();
 
 #endif /* !SIMPLEDISK_H */
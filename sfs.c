@@ -22,6 +22,10 @@
 #include "sfs.h"
 #include "sdisk.h"
 #include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 
 /*
  *	global variables
@@ -29,19 +33,58 @@
 
 #define MAXINODE	2000//	minimun should be SD_NUMSECTORS/7, but the wores case is: each file takes one iNode, so the total number will reach 2000
 #define MAXFPTAB	2000//	for file descriptor table, it is in memory
+#define MAXDIRTAB	64//	for directory stream table, it is in memory
+#define NUMCACHE	128//	sectors kept in the block cache
+#define MINREADAHEAD	4//	readahead window in sectors once a file is read sequentially
+#define MAXREADAHEAD	32//	the window doubles up to this, a quarter of the cache
+#define INLINESIZE	(7 * sizeof(int))//	files up to the size of toblock[] are kept inside the inode
+#define WBUFSIZE	(8 * SD_SECTORSIZE)//	small writes to an open file are gathered up to this before they reach the disk
+#define NUMHEADER	(sizeof(disk_t)/SD_SECTORSIZE + 1 * (sizeof(disk_t)%SD_SECTORSIZE != 0))//	sectors the disk_t takes at the start of the disk
+#define JOURNALSIZE	64//	sectors of the metadata journal, right after the checksum and snapshot tables
+#define CSUMSIZE	((SD_NUMSECTORS * sizeof(unsigned int) + SD_SECTORSIZE - 1) / SD_SECTORSIZE)//	sectors of the checksum table, right after the disk_t
+#define SNAPSTART	(NUMHEADER + CSUMSIZE)//	the snapshot table, right after the checksum table
+#define SNAPSIZE	((sizeof(snaptab_t) + SD_SECTORSIZE - 1) / SD_SECTORSIZE)
+#define NUMMETA		(SNAPSTART + SNAPSIZE)//	the disk_t, the checksum table and the snapshot table, kept in maindisk and journaled together
+#define MAXSNAP		8//	snapshots kept at once
+#define NUMGROUP	8//	allocation groups, each a slice of the sectors and of the inodes; a dir and its files share one
+#define GROUPSECTORS	(SD_NUMSECTORS / NUMGROUP)
+#define GROUPINODES	(MAXINODE / NUMGROUP)
+#define MAXSHARE	255//	live files besides the first that may share a sector, so the count fits a char
+#define SNAPNAMELEN	16
+#define JSTART		NUMMETA//	the journal super sector, groups of transactions follow it
+#define JMAXBLOCKS	(JOURNALSIZE - 3)//	most sectors one group can log, besides the super, descriptor and commit sectors
+#define JGROUP		16//	transactions gathered before they are committed together
+#define JCHANGE(n)	(8 + (n) / 32)//	most header sectors a change to n sectors of a file touches: the inodes of its chain, and the bitmap, checksum and share entries of the sectors
+#define JMAGIC		0x53465331//	"SFS1", tells a journal sector from garbage
+#define CRCPOLY		0x82f63b78//	CRC32C (Castagnoli), reflected
+#define CRCSTRIDE	168//	bytes in each of the three streams of crc32c_hw, 3 * 168 + 8 is a sector
+#define FSCKRANGE	64//	inodes a checker thread takes at a time
+#define MAXFSCKTHREAD	64
+#define FSCK_BADSIZE	1//	problems fsck finds with an inode
+#define FSCK_BADSECTOR	2
+#define FSCK_BADCHAIN	4
+#define FSCK_BADDOT	8
+#define FSCK_BADENTRY	16
+#define FSCK_BADCSUM	32//	reported by sector, it keeps a dir from being read
 
 typedef struct {//	i-node structure
 	//	some attributes
 	int size;
 	int numsector;// how many sectors is been used
-	int	status;//	0 means unused, 1 means it is a directory, 2 means it is a file
-	int	toblock[7];//	to the sector ID
+	int	status;//	0 means unused, 1 means it is a directory, 2 means it is a file, 3 means it is in the toinode chain of another inode
+	int	toblock[7];//	to the sector ID, a file with numsector 0 keeps its data right here instead
 	int	toinode;// to next inode
 } inode_t;
 
 typedef struct {// file descriptor sturcture in memory
 	int	fptab[MAXFPTAB];// the inode of the file
 	int	pos[MAXFPTAB];
+	int	ranext[MAXFPTAB];// where a sequential read would start next
+	int	rawin[MAXFPTAB];// readahead window in sectors, 0 means the reads are random
+	int	raend[MAXFPTAB];// the sectors before this one are already prefetched
+	char*	wbuf[MAXFPTAB];// write buffer, allocated at the first small write, NULL means none
+	int	wbpos[MAXFPTAB];// the position in the file of wbuf[0]
+	int	wblen[MAXFPTAB];// how many bytes of wbuf are waiting, 0 means nothing
 } fptab_t;
 
 typedef struct {// file sturcture for file header, it is a file sturcture in the sector
@@ -49,6 +92,81 @@ typedef struct {// file sturcture for file header, it is a file sturcture in the
 	int		inode;// point back to its inode. whether it is a ture file ot a directory is defined in inode. It is a inodeID, from 0 to 2000
 } file_t;
 
+typedef struct {// directory stream cursor in memory, only one sector of the dir is kept
+	int		inode;// the inode of the dir, -1 means unused
+	int		pos;// the next file_t slot to return
+	int		sector;// the logical sector held in buf, -1 means none
+	char	buf[SD_SECTORSIZE];
+} dircur_t;
+
+typedef struct {// one sector kept in the block cache
+	int		sector;// the sector ID, 0 means the entry is empty
+	int		pin;// how many views handed out by sfs_mapread still use it, it is not reused until 0
+	int		used;// referenced since the clock hand last passed
+	int		dirty;// a metadata sector waiting in the journal group, it is pinned and newer than the disk
+	char	data[SD_SECTORSIZE];
+} cache_t;
+
+typedef struct {// journal super sector
+	int		magic;
+	int		seq;// the last group that is home, the next one to replay is seq + 1
+	int		head;// where the next group goes
+} jsuper_t;
+
+typedef struct {// first sector of a group in the journal, the logged sectors follow it, then a commit sector
+	int		magic;
+	int		seq;
+	int		count;// how many sectors are logged
+	int		home[JMAXBLOCKS];// where each of them belongs
+} jdesc_t;
+
+typedef struct {// last sector of a group, a group without it never happened
+	int		magic;
+	int		seq;
+	int		count;
+	unsigned int	sum;// of the logged sectors, so a commit written before all of them is not trusted
+} jcommit_t;
+
+typedef struct {// what sfs_fsck learns, shared by its threads, which only touch it with atomic ops or in their own inodes
+	int		owner[SD_NUMSECTORS];// the lowest inode using the sector, -1 means none
+	int		uses[SD_NUMSECTORS];// how many times the files and dirs name it
+	int		other[SD_NUMSECTORS];// the highest inode using it, the other one when it is cross-linked, -1 means none
+	int		chainof[MAXINODE];// the lowest inode whose toinode chain holds this one, -1 means none
+	int		links[MAXINODE];// dir entries naming the inode
+	int		parent[MAXINODE];// the lowest dir holding an entry naming it
+	int		dotdot[MAXINODE];// what ".." of a dir names
+	int		flags[MAXINODE];// FSCK_ problems found with the inode
+	char	badcsum[SD_NUMSECTORS];// the sector doesn't match its checksum
+	char	snapcopy[SD_NUMSECTORS];// the sector holds a snapshot's copy of the inode table
+	int		next;// the first inode of the range the next thread takes
+	int		phase;// 0 while the inodes are walked, 1 while the dirs are read
+} fsck_t;
+
+typedef struct {// a snapshot: a copy of the inode table as it was, sharing every sector with the live filesystem until one of them writes it
+	char	name[SNAPNAMELEN];// "" for a free slot
+	int		start;// the first sector of the copy, they are contiguous
+	int		numsector;// sectors in the copy, the inodes after it were free
+} snap_t;
+
+typedef struct {// on disk after the checksum table
+	snap_t	snap[MAXSNAP];
+	unsigned short	refcnt[SD_NUMSECTORS];// how many times the snapshots name the sector, one that is not 0 is never written in place or freed
+	unsigned char	share[SD_NUMSECTORS];// how many live files besides the first name it, sfs_clone shares sectors this way
+} snaptab_t;
+
+typedef struct {// a sector of file data sfs_readimage reads, they are sorted by sector
+	int		sector;
+	int		ent;// the entry of the file
+	int		n;// which sector of the file it is
+} readreq_t;
+
+typedef struct {// cursor over the buffers of a sfs_iovec_t array
+	sfs_iovec_t*	iov;
+	int		iovcnt;
+	int		idx;// the buffer we are in
+	int		off;// the byte within that buffer
+} iovcur_t;
+
 typedef struct {// disk sturcture for disk header
 	
 	inode_t			inode[MAXINODE];
@@ -58,19 +176,107 @@ typedef struct {// disk sturcture for disk header
 } disk_t;
 
 disk_t*		maindisk;
+char*		shadowdisk;// the header sectors as they were last written, to tell which parts of maindisk changed
 fptab_t*	mainfptab;
+dircur_t*	maindirtab;// directory stream table, MAXDIRTAB cursors
 int			cwd;// current working dir, it is the inode index.
+cache_t*	maincache;// block cache, NUMCACHE sectors
+int			cachemap[SD_NUMSECTORS];// the cache entry of each sector, -1 means not cached
+int			cachehand;// clock hand for replacement
+int			wbowner[MAXINODE];// the file descriptor index whose write buffer holds data of the inode, -1 means none
+pthread_mutex_t	cachelock = PTHREAD_MUTEX_INITIALIZER;// readers of one file may come from many threads
+const char	zerosector[SD_SECTORSIZE];// what a hole looks like
+jsuper_t	mainjsuper;// the journal super sector, as it is on disk
+int			jdirty[JMAXBLOCKS];// the dir sectors waiting in the cache for the next group
+int			numjdirty;
+int			numtrans;// transactions in the group so far
+unsigned int*	csumtab;// the checksum of every sector, it lives in maindisk right after the disk_t; 0 means none is known
+snaptab_t*	snaptab;// the snapshots, in maindisk after csumtab
+int			readonly;// a snapshot is mounted, nothing may change
+int			defragnext;// the inode sfs_defrag looks at next
+unsigned int	crctable[8][256];// CRC32C, slicing by 8
+unsigned int	crcshift[4][256];// moves a CRC over CRCSTRIDE zero bytes, to join the streams of crc32c_hw
+unsigned int	(*crc32c)(unsigned int crc, const unsigned char* data, int len);// crc32c_hw if the cpu has it, crc32c_sw otherwise
 
+void	tables_init();//	allocate the in-memory tables the first time, and empty them
+void	header_sync(int sector);//	write a sector of maindisk to the disk if it differs from what is there
+void	meta_sync();//	write out every changed header sector, the bitmap first
+int		journal_write(int sector, void* buf);//	write a dir sector as part of the running transaction, it stays in the cache until the group is committed; return -1 if the group has no room left for it
+int		journal_end();//	end a transaction, committing the group once it holds JGROUP of them or is half full, return -1 fail
+int		journal_room(int count);//	commit the running group first if count more sectors would not fit in it, before a transaction starts changing anything; return -1 fail
+int		journal_size();//	the sectors the running group would log: the dirty dir sectors and the header sectors that changed
+int		journal_commit();//	log the dirty dir sectors and changed header sectors as one group, then write them home; return -1 if they don't fit, the group is then kept in memory
+void	journal_abort();//	drop the running group: the header goes back to what the disk has, the dirty dir sectors leave the cache, and descriptors, dir streams and a cwd naming what is gone are dropped
+void	journal_replay();//	write home the group that was committed but maybe not written home before a crash
+unsigned int	journal_sum(void* data, unsigned int sum);//	add a sector to the checksum of a group
+int		sector_cow(int* toblock);//	make the sector *toblock names private to its file before it is written, moving it to a new sector if a snapshot or another file shares it; return the sector to write, -1 if the disk is full
+int		snap_find(char* name);//	the slot of the snapshot, -1 not found
+void	snap_count(inode_t* table, int numinode, unsigned short* map);//	add 1 to map[] for every time the files and dirs in table name a sector
+void	crc_init();//	build the CRC tables and pick crc32c, only the first time
+unsigned int	crc32c_sw(unsigned int crc, const unsigned char* data, int len);//	CRC32C of data on top of crc, by table, no inversion
+unsigned int	crc32c_hw(unsigned int crc, const unsigned char* data, int len);//	the same with the SSE4.2 crc32 instruction
+unsigned int	crc_shift(unsigned int crc);//	crc after CRCSTRIDE zero bytes
+unsigned int	csum_of(void* data);//	the checksum of a sector, never 0
+int		csum_check(int sector, void* data);//	return -1 if data is not what was written to sector, 0 if it is or nothing is known
+void	meta_csum();//	update the checksums of the header and snapshot table sectors that changed since they were written
+void*	fsck_run(void* ck);//	a checker thread, taking ranges of inodes until none is left
+int		fsck_min(int* p, int v);//	lower *p to v if it is -1 or higher, returning what it held, so the result is the same whatever order the threads come in
+int		fsck_max(int* p, int v);//	raise *p to v if it is lower, the same way
+void	fsck_inode(fsck_t* ck, int inode);//	check the size and toinode chain of a file or dir, and mark the sectors it uses
+void	fsck_dir(fsck_t* ck, int inode);//	check the entries of a dir and count the links they make
 void	fillbitmap(int sector);
 void	emptybitmap(int sector);
 void	init_inode(inode_t* inode);
 void	init_dir(inode_t* thisdirinode, inode_t* upperdirinode);
-int		findanemptysector();
-int		findanemptyinode();
-void*	inode_read(int inode);//	inode is the index of the inode array, don't forget to free it, return NULL not found!
+int		findanemptysector(int goal);//	the first free sector from goal on, going around to the start of the disk, return -1 if the disk is full
+int		bitmap_deferred();//	1 if a sector freed in the running group waits for its commit to be reused
+int		findanemptyinode(int group);//	the first free inode of the group, or of the groups after it, return -1 if there is none
+int		findanemptyrun(int goal, int count, int* found);//	the first run of count free sectors from goal on, or the longest one if there is none that long; found is set to its length, return -1 if the disk is full
+int		group_of(int inode);//	the allocation group of a file or dir, its inode number tells
+int		group_pick();//	the group for a new dir: the one with the most free sectors that still has a free inode
+int		inode_goal(int inode);//	where the next sector of the inode should go: right after its last one, or at the start of its group
+void*	inode_read(int inode);//	inode is the index of the inode array, don't forget to free it, return NULL not found or corrupt!
 int		inode_append(int inode);// only append a sector fot that inode, and fill the bitmap, return 0 successfully, return -1 fail
-void	inode_write(int inode, void* data);//	data is the point in the memory, you should append the inode first!!!!!
+int		inode_uninline(int inode);//	move the data kept inside the inode to a sector of its own, return 0 successfully, return -1 fail
+int		inode_walk(int inode, int n);//	the inode of the toinode chain holding the n-th sector, return -1 if the chain is shorter
+int		file_truncate(int inode, int length);//	cut or grow the file to length bytes, return 0 successfully, return -1 fail
+void	inode_truncate(int inode, int numsector);//	free every sector from numsector on and the chain inodes left empty, in one pass
+int		inode_extend(int inode, int numsector);//	grow the mapping to numsector with holes only, nothing is allocated, return 0 successfully, return -1 fail
+int		file_read(int inode, char* buffer, int pos, int length);//	read only the sectors under [pos, pos + length), holes read as zeros, return -1 fail
+int		file_write(int inode, char* buffer, int pos, int length);//	write only the sectors under [pos, pos + length), allocating the holes it fills, return -1 fail
+int		file_readv(int inode, sfs_iovec_t* iov, int iovcnt, int pos, int length);//	file_read, scattering into the buffers of iov in one walk of the mapping
+int		file_writev(int inode, sfs_iovec_t* iov, int iovcnt, int pos);//	file_write, gathering from the buffers of iov so each sector is written once
+int		iov_length(sfs_iovec_t* iov, int iovcnt);//	total length of iov, return -1 if it is bogus
+void	iov_start(iovcur_t* cur, sfs_iovec_t* iov, int iovcnt);//	set up a cursor at the first byte of iov
+char*	iov_contig(iovcur_t* cur, int len);//	the next len bytes if they are in one buffer, and step over them, return NULL otherwise
+void	iov_gather(iovcur_t* cur, char* dst, int len);//	copy the next len bytes of iov out to dst
+void	iov_scatter(iovcur_t* cur, char* src, int len);//	copy len bytes from src into the next bytes of iov
+int		file_zero(int inode, int from, int to);//	zero the bytes of [from, to) that have a sector behind, holes are left alone, return -1 fail
+int		file_invalidate(int inode, int from, int to);//	file data is written in place outside the journal: clear the checksums the disk has for the sectors of [from, to) and commit that once, before any of them is overwritten, so a crash never leaves new data next to an old checksum; return -1 fail
+void	cache_init();//	empty the block cache, allocating it the first time
+cache_t*	cache_get(int sector, int fill);//	the cache entry of sector, reading it in if fill, return NULL if every entry is pinned or it reads corrupt; hold cachelock
+int		fd_flush(int fd);//	write out what waits in the write buffer of fd, allocating its sectors now, return -1 fail
+int		file_flush(int inode);//	fd_flush the write buffer holding data of inode, if any, before anything else looks at the file
+void	file_discard(int inode);//	forget the buffered data of inode, it is being removed
+void	file_readahead(int fd, int length);//	after a read of length bytes at the pos of fd, prefetch the next window of its sectors if the reads look sequential
+void	cache_prefetch(int sector);//	read sector into the block cache without marking it used; hold cachelock
+int		sector_read(int sector, void* buf);//	read a sector through the block cache and verify its checksum, return 0 successfully, return -1 fail
+int		sector_write(int sector, void* buf);//	write a sector through to the disk, keeping the block cache up to date, return 0 successfully, return -1 fail
+int		inode_write(int inode, void* data);//	data is the point in the memory, you should append the inode first!!!!! only dirs are written this way, through the journal; return -1 if a shared sector couldn't be copied
 void	inode_erase(int inode);//	erase the inode, including emptybitmap and init_inode
+int		inode_getsector(int inode, int n);//	the sector ID of the n-th sector of the inode, walking the toinode chain
+void	dir_open(dircur_t* dir, int inode);//	set up a cursor at the first file_t of the dir
+int		dir_next(dircur_t* dir, file_t* entry);//	copy the next file_t out, return its slot, return -1 at the end of the dir
+int		dir_lookup(int dirinode, char* name);//	the inode of name within the dir, return -1 not found
+int		path_lookup(char* path);//	the inode of a relative or absolute path, return -1 not found
+int		path_parent(char* path, char* name);//	the inode of the dir holding the last name of path, which is copied to name, return -1 not found or bad
+int		dir_set(int dirinode, char* name, char* newname, int inode);//	rename the entry name of the dir, or a free one if name is NULL, to newname and point it at inode, through the journal; return -1 fail
+void	inode_stat(int inode, sfs_stat_t* st);//	fill st from the inode and its chain only, no data is read
+void	inode_frag(int inode, int* numrun, int* numgap, int* seek);//	the runs of sectors the holes of the inode leave, the steps from one sector to its next and the sectors skipped on them
+int		file_relocate(int inode);//	move the sectors of a fragmented file or dir into one free run, return how many moved, 0 if it stays, -1 fail
+int		dir_sectors(int numentry);//	the sectors a dir needs for numentry file_t, "." and ".." included
+int		readreq_cmp(const void* a, const void* b);//	qsort order of readreq_t, by sector
+void	image_free(sfs_imgent_t* ents, int numents);//	free what sfs_readimage allocated
 
 /*
  * sfs_mkfs: use to build your filesystem
@@ -83,13 +289,7 @@ void	inode_erase(int inode);//	erase the inode, including emptybitmap and init_i
 int sfs_mkfs() {
 //	maindisk = malloc(sizeof(disk_t));
 //	mainfptab = malloc(sizeof(fptab_t));
-	if(mainfptab == 0)
-	{
-		mainfptab = malloc(sizeof(fptab_t));
-	}
-	if(maindisk == 0){
-		maindisk = malloc(sizeof(disk_t) + 2 * SD_NUMSECTORS);
-	}
+	tables_init();
 
 	int i;
 	for(i = 0; i < MAXINODE; ++i)
@@ -100,45 +300,57 @@ int sfs_mkfs() {
 	{
 		(*maindisk).bitmap[i] = 0;
 	}
+	memset(csumtab, 0, CSUMSIZE * SD_SECTORSIZE);
+	memset(snaptab, 0, SNAPSIZE * SD_SECTORSIZE);
 	
 	//	here we plus one, because sizeof(disk_t)/SD_SECTORSIZE will be rounded, we should take consideration of the remainder
 	for(i = 0; i < sizeof(disk_t)/SD_SECTORSIZE + 1 * (sizeof(disk_t)%SD_SECTORSIZE != 0); ++i)
 	{
 		fillbitmap(i);
 	}
-
-	// init table
-	for (i = 0; i < MAXFPTAB; ++i)
+	for(i = NUMHEADER; i < JSTART + JOURNALSIZE; ++i)//	the checksum and snapshot tables and the journal
 	{
-		(*mainfptab).fptab[i] = 0;
-		(*mainfptab).pos[i] = 0;
+		fillbitmap(i);
 	}
-	
+
 	//	init root dir
 	(*maindisk).inode[0].numsector = 1;
 	(*maindisk).inode[0].status = 1;
-	(*maindisk).inode[0].toblock[0] = sizeof(disk_t)/SD_SECTORSIZE + 1 * (sizeof(disk_t)%SD_SECTORSIZE != 0);//	next available sector
+	(*maindisk).inode[0].toblock[0] = JSTART + JOURNALSIZE;//	next available sector
 	fillbitmap((*maindisk).inode[0].toblock[0]);
 	
+	char data[SD_SECTORSIZE] = "";
 	file_t* thisdir;//	"."
 	file_t* upperdir;//	".."
-	thisdir = (void*)maindisk + (*maindisk).inode[0].toblock[0] * SD_SECTORSIZE;
-	upperdir = (void*)maindisk + (*maindisk).inode[0].toblock[0] * SD_SECTORSIZE + sizeof(file_t);
+	thisdir = (void*)data;
+	upperdir = (void*)data + sizeof(file_t);
 	
 	strcpy((*thisdir).name, ".");
 	strcpy((*upperdir).name, "..");
 	(*thisdir).inode = 0;//	they point to the same inode, because root has no upper dir.
 	(*upperdir).inode = 0;
-	while(SD_write((*maindisk).inode[0].toblock[0], (void*)thisdir));//	write back the root as a file
+	sector_write((*maindisk).inode[0].toblock[0], (void*)thisdir);//	write back the root as a file
 	
 	cwd = 0; // cwd indicate current working dir is inode[0], it is root dir
 	
 	
-	// write back the disk_t
-	for(i = 0; i < sizeof(disk_t)/SD_SECTORSIZE + 1 * (sizeof(disk_t)%SD_SECTORSIZE != 0); ++i)
+	// write back the disk_t and the checksum and snapshot tables
+	memset(shadowdisk, 0xff, NUMMETA * SD_SECTORSIZE);//	so every sector gets its checksum
+	meta_csum();
+	for(i = 0; i < NUMMETA; ++i)
 	{
 		while(SD_write(i, (void*)maindisk + i * SD_SECTORSIZE));
 	}
+	memcpy(shadowdisk, maindisk, NUMMETA * SD_SECTORSIZE);
+	
+	//	an empty journal; the sequence goes on from the old one, so no group left there by it can ever be replayed
+	while(SD_read(JSTART, data));
+	mainjsuper.seq = ((*(jsuper_t*)data).magic == JMAGIC)? (*(jsuper_t*)data).seq + 2 : 0;
+	mainjsuper.magic = JMAGIC;
+	mainjsuper.head = JSTART + 1;
+	memset(data, 0, SD_SECTORSIZE);
+	memcpy(data, &mainjsuper, sizeof(jsuper_t));
+	while(SD_write(JSTART, data));
 	//SD_write(0, char *buf);
 //	free(maindisk);// always keep it.
 //	maindisk = 0;
@@ -146,6 +358,41 @@ int sfs_mkfs() {
 	return 0;
 } /* !sfs_mkfs */
 
+/*
+ * sfs_mount: load the filesystem already on the disk, as it was left by
+ *   the last committed journal group, which is replayed first if it
+ *   did not make it home. Every open file and directory stream is
+ *   forgotten and the cwd goes back to the root.
+ *
+ * Parameters: -
+ *
+ * Returns: 0 on success, or -1 if the disk holds no filesystem or its
+ *   header doesn't match its checksums
+ *
+ */
+int sfs_mount() {
+	int i;
+	
+	tables_init();
+	journal_replay();
+	for(i = 0; i < NUMMETA; ++i)
+	{
+		while(SD_read(i, (void*)maindisk + i * SD_SECTORSIZE));
+	}
+	memcpy(shadowdisk, maindisk, NUMMETA * SD_SECTORSIZE);
+	if((*maindisk).inode[0].status != 1 || ((*maindisk).bitmap[0] & 1) == 0){//	root is a dir and sector 0 is always used
+		return -1;
+	}
+	for(i = 0; i < NUMMETA; ++i)
+	{
+		if(csum_check(i, (void*)maindisk + i * SD_SECTORSIZE)){//	the inodes, the bitmap or the snapshot table are corrupt
+			return -1;
+		}
+	}
+	cwd = 0;
+	return 0;
+} /* !sfs_mount */
+
 /*
  * sfs_mkdir: attempts to create the name directory
  *
@@ -157,23 +404,36 @@ int sfs_mkfs() {
 int sfs_mkdir(char *name) {
 	void* thisdir = inode_read(cwd);
 	file_t* tmpfile = thisdir;
+	if(thisdir == NULL || readonly){
+		free(thisdir);
+		return -1;
+	}
 	char data[512]="";
+	int grown = 0;
 	
 	//	find a place to save the "dir" file within the cwd
 	void* tmpend = (*maindisk).inode[cwd].numsector * SD_SECTORSIZE + thisdir - sizeof(file_t);//	the last file
 	if(name[0] == 0)
 	{
+		free(thisdir);
 		return -1;
 	}
 	int i = 0;
 	for(i = 0; name[i] != 0; ++i)
 	{
 		if(name[i] == '/'){
+			free(thisdir);
 			return -1;
 		}
 	}
+	//	the new dir's sector and inode, and every sector of the cwd, which may grow by one
+	if(journal_room(JCHANGE(2) + (*maindisk).inode[cwd].numsector + 2)){
+		free(thisdir);
+		return -1;
+	}
 	while(1){
 		if ( !strcmp( (*tmpfile).name, name )) { // found a matching file
+			free(thisdir);
 			return -1;
 			/*if((*maindisk).inode[(*tmpfile).inode].status == 1){
 				//	yes it is also a dir
@@ -184,10 +444,11 @@ int sfs_mkdir(char *name) {
 		
 		if((void*)tmpfile >= tmpend){
 			//	there is not enough space to save it
-			if(inode_append(cwd)){
+			if(inode_append(cwd)){//	it changes nothing when it fails
 				free(thisdir);
 				return -1;
 			}
+			grown = 1;
 			void* tmpdir = malloc((*maindisk).inode[cwd].numsector * SD_SECTORSIZE);// use a new memory
 			tmpfile = tmpdir + ((void*)tmpfile - thisdir);
 			memcpy(tmpdir, thisdir, ((*maindisk).inode[cwd].numsector - 1 )* SD_SECTORSIZE);
@@ -202,18 +463,18 @@ int sfs_mkdir(char *name) {
 	}
 	
 	strcpy((*tmpfile).name, name);
-	(*tmpfile).inode = findanemptyinode();
-	if((*tmpfile).inode == -1){
+	(*tmpfile).inode = findanemptyinode(group_pick());//	dirs are spread over the groups, their files follow them
+	i = ((*tmpfile).inode == -1)? -1 : findanemptysector(group_of((*tmpfile).inode) * GROUPSECTORS);
+	if(i == -1){//	only the sector the cwd grew by is to be dropped
+		if(grown){
+			journal_abort();
+		}
 		free(thisdir);
 		return -1;
 	}
 	(*maindisk).inode[(*tmpfile).inode].numsector = 1;
 	(*maindisk).inode[(*tmpfile).inode].status = 1;
-	(*maindisk).inode[(*tmpfile).inode].toblock[0] = findanemptysector();
-	if((*maindisk).inode[(*tmpfile).inode].toblock[0] == -1){
-		free(thisdir);
-		return -1;
-	}
+	(*maindisk).inode[(*tmpfile).inode].toblock[0] = i;
 	fillbitmap((*maindisk).inode[(*tmpfile).inode].toblock[0]);
 	
 	
@@ -226,14 +487,24 @@ int sfs_mkdir(char *name) {
 	strcpy((*upperdir).name, "..");
 	(*newdir).inode = (*tmpfile).inode;//	new dir's inode
 	(*upperdir).inode = cwd;
-	while(SD_write((*maindisk).inode[(*tmpfile).inode].toblock[0], (void*)newdir));
+	i = journal_write((*maindisk).inode[(*tmpfile).inode].toblock[0], (void*)newdir);
 	
 	
 	//	write back the current working dir
-	inode_write(cwd, thisdir);
+	if(i == 0){
+		i = inode_write(cwd, thisdir);
+	}
+	if(i){//	a shared sector couldn't be copied or the cache is all pinned, the new dir goes with the group
+		journal_abort();
+		free(thisdir);
+		return -1;
+	}
+	if(journal_end()){
+		i = -1;
+	}
 		
 	free(thisdir);
-	return 0;
+	return i;
 } /* !sfs_mkdir */
 
 /*
@@ -263,6 +534,9 @@ int sfs_fcd(char* name) {
 	}
 	void* thisdir = inode_read(cwd);
 	file_t* tmpfile = thisdir;
+	if(thisdir == NULL){
+		return -1;
+	}
 	int i,slash = 0;
 	for(i = 0; name[i] != 0; ++i)
 	{
@@ -314,38 +588,145 @@ int sfs_fcd(char* name) {
  *
  */
 int sfs_ls(FILE* f) {
-	void* thisdir = inode_read(cwd);
-	file_t* tmpfile = thisdir;
+	dircur_t dir;
+	file_t tmpfile;
 	char temp[17];
 	
-	//	find all the file within the cwd
-	void* tmpend = (*maindisk).inode[cwd].numsector * SD_SECTORSIZE + thisdir - sizeof(file_t);//	the last file
-	while(1){
-		
-		
-		if((void*)tmpfile >= tmpend){
-			break;
-		}
-		if((*tmpfile).name[0] == 0){
-			break;
-		}
-		else if((*tmpfile).name[0] == '.'){
-			tmpfile = (void*)tmpfile + sizeof(file_t);
+	//	stream all the file within the cwd, one sector at a time
+	dir_open(&dir, cwd);
+	while(dir_next(&dir, &tmpfile) != -1){
+		if(tmpfile.name[0] == '.'){
 			continue;
 		}
-		strncpy(temp, (*tmpfile).name, 16);
+		strncpy(temp, tmpfile.name, 16);
 		temp[16] = 0;
 		fprintf(f, "%s\n", temp);
-		//fprintf(f, "%s\n", (*tmpfile).name);
-		//puts((*tmpfile).name);
-		tmpfile = (void*)tmpfile + sizeof(file_t);
 	}
-		
-	free(thisdir);
 	return 0;
-//	return -1;
 } /* !sfs_ls */
 
+/*
+ * sfs_opendir: open a stream over the entries of the named directory.
+ *   Only one sector of the directory is held in memory at a time, so
+ *   huge directories are listed in constant memory.
+ *
+ * Parameters: directory name, relative to the cwd or absolute; "" and
+ *   "." open the cwd
+ *
+ * Returns: the new directory stream ID, or -1 if an error occurred
+ *
+ */
+int sfs_opendir(char* name) {
+	int dirinode;
+	int i;
+	
+	if(name == NULL || (dirinode = path_lookup(name)) == -1 || (*maindisk).inode[dirinode].status != 1){//	"" and "." are the cwd
+		return -1;
+	}
+	for(i = 0; i < MAXDIRTAB; ++i)
+	{
+		if(maindirtab[i].inode == -1){// found an empty slot
+			dir_open(&maindirtab[i], dirinode);
+			return i + 1;// the index + 1 for the directory stream ID
+		}
+	}
+	return -1;
+} /* !sfs_opendir */
+
+/*
+ * sfs_readdir: return the next entry of a directory stream, like
+ *   getdents. "." and ".." are returned, removed entries are skipped.
+ *
+ * Parameters: directory stream ID and the entry to fill in
+ *
+ * Returns: 1 if an entry was returned, 0 at the end of the directory,
+ *   or -1 if an error occurred
+ *
+ */
+int sfs_readdir(int dirID, sfs_dirent_t* entry) {
+	int i = dirID - 1;
+	int slot;
+	file_t tmpfile;
+	
+	if (i < 0 || i > MAXDIRTAB - 1 || entry == NULL)
+		return -1;
+	if (maindirtab[i].inode == -1)
+		return -1;
+	
+	while(1){
+		if((slot = dir_next(&maindirtab[i], &tmpfile)) == -1){
+			return 0;
+		}
+		if(slot > 0 && !strcmp(tmpfile.name, ".")){// removed by sfs_rm
+			continue;
+		}
+		break;
+	}
+	strncpy((*entry).name, tmpfile.name, 16);
+	(*entry).name[16] = 0;
+	(*entry).inode = tmpfile.inode;
+	if(file_flush(tmpfile.inode)){
+		return -1;
+	}
+	(*entry).type = (*maindisk).inode[tmpfile.inode].status;
+	(*entry).size = (*maindisk).inode[tmpfile.inode].size;
+	return 1;
+} /* !sfs_readdir */
+
+/*
+ * sfs_telldir: the current cursor of a directory stream
+ *
+ * Parameters: directory stream ID
+ *
+ * Returns: the cursor, to be given back to sfs_seekdir, or -1 if an
+ *   error occurred
+ *
+ */
+int sfs_telldir(int dirID) {
+	int i = dirID - 1;
+	
+	if (i < 0 || i > MAXDIRTAB - 1 || maindirtab[i].inode == -1)
+		return -1;
+	return maindirtab[i].pos;
+} /* !sfs_telldir */
+
+/*
+ * sfs_seekdir: resume a directory stream from a cursor returned by
+ *   sfs_telldir
+ *
+ * Parameters: directory stream ID and cursor
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ *
+ */
+int sfs_seekdir(int dirID, int position) {
+	int i = dirID - 1;
+	
+	if (i < 0 || i > MAXDIRTAB - 1 || maindirtab[i].inode == -1)
+		return -1;
+	if (position < 0)
+		return -1;
+	maindirtab[i].pos = position;
+	return 0;
+} /* !sfs_seekdir */
+
+/*
+ * sfs_closedir: close a directory stream so that its ID may be reused
+ *
+ * Parameters: directory stream ID
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ *
+ */
+int sfs_closedir(int dirID) {
+	int i = dirID - 1;
+	
+	if (i < 0 || i > MAXDIRTAB - 1 || maindirtab[i].inode == -1)
+		return -1;
+	maindirtab[i].inode = -1;
+	return 0;
+} /* !sfs_closedir */
+
 /*
  * sfs_fopen: convert a pathname into a file descriptor. When the call
  *   is successful, the file descriptor returned will be the lowest file
@@ -361,19 +742,25 @@ int sfs_fopen(char* name) {
     // look through cwd inode for name, store int index for file inode, if not there make new inode file, store in cwd inode, and store inode as return index
 	void* currentdir = inode_read(cwd);
 	file_t* tmpfile = currentdir;
+	if(currentdir == NULL){
+		return -1;
+	}
 
 	int filenode; // storing inode index
 	int newfile = 0; // to continue and make newfile or not
+	int grown = 0; // the cwd took one more sector for the new entry
 	
 	int j = 0;
 	for(j = 0; name[j] != 0; ++j)
 	{
 		if(name[j] == '/'){
+			free(currentdir);
 			return -1;
 		}
 	}
 	if(name[0] == 0)
 	{
+		free(currentdir);
 		return -1;
 	}
 	void* tmpend = (*maindisk).inode[cwd].numsector * SD_SECTORSIZE + currentdir - sizeof(file_t); // last file
@@ -387,6 +774,7 @@ int sfs_fopen(char* name) {
 		if ( !strcmp( (*tmpfile).name, name )) { // found a matching file
 			if((*maindisk).inode[(*tmpfile).inode].status == 1){
 					//	yes it is also a dir
+					free(currentdir);
 					return -1;
 			}
 			filenode = (*tmpfile).inode; // set the inode			
@@ -397,6 +785,20 @@ int sfs_fopen(char* name) {
 	}
 
 	if (newfile) { // need to create a newfile	
+		if (readonly) { // a snapshot is mounted
+			free(currentdir);
+			return -1;
+		}
+		for (j = 0; j < MAXFPTAB && (*mainfptab).fptab[j] != 0; ++j); // a descriptor to return, before the file is made
+		if (j == MAXFPTAB) {
+			free(currentdir);
+			return -1;
+		}
+		// the new inode, and every sector of the cwd, which may grow by one
+		if (journal_room(JCHANGE(1) + (*maindisk).inode[cwd].numsector + 1)) {
+			free(currentdir);
+			return -1;
+		}
 		// get inode, add file_t to end of cwd, and set filenode to the inode
 		tmpfile = currentdir;
 		char data[512] = "";
@@ -405,10 +807,11 @@ int sfs_fopen(char* name) {
 			tmpfile = (void*)tmpfile + sizeof(file_t);
 			
 			if ( (void*)tmpfile >= tmpend ) { // not enough space, need to append our inode with additional sector
-				if (inode_append(cwd)) {
+				if (inode_append(cwd)) { // it changes nothing when it fails
 					free(currentdir);
 					return -1;
 				}
+				grown = 1;
 				
 				void* tmp = malloc((*maindisk).inode[cwd].numsector * SD_SECTORSIZE); // new memory allocated
 				tmpfile = tmp + ((void*)tmpfile - currentdir);
@@ -424,27 +827,27 @@ int sfs_fopen(char* name) {
 		}
 
 		strcpy( (*tmpfile).name, name); // copy our name to the tmpfile
-		(*tmpfile).inode = findanemptyinode();
-		inode_write(cwd, currentdir); // write it back
-		if ((*tmpfile).inode == -1) { // couldn't find an empty inode
+		(*tmpfile).inode = findanemptyinode(group_of(cwd)); // in the group of its dir
+		if ((*tmpfile).inode == -1) { // couldn't find an empty inode, only the sector the cwd grew by is to be dropped
+			if (grown)
+				journal_abort();
 			free(currentdir);
-			return -1; 	
+			return -1;
 		}
-		(*maindisk).inode[(*tmpfile).inode].numsector = 1; // initialize our new file's inode values
+		(*maindisk).inode[(*tmpfile).inode].numsector = 0; // initialize our new file's inode values, no sector until it outgrows the inode
 		(*maindisk).inode[(*tmpfile).inode].status = 2; // a file
 		(*maindisk).inode[(*tmpfile).inode].size = 0; //size
-		(*maindisk).inode[(*tmpfile).inode].toblock[0] = findanemptysector();
-		
-		
-		while(SD_write((*maindisk).inode[(*tmpfile).inode].toblock[0], (void*)data));
-		
-		if ((*maindisk).inode[(*tmpfile).inode].toblock[0] == -1) { // couldn't find an empty sector for file's data
+		if (inode_write(cwd, currentdir)) { // write it back, a shared sector couldn't be copied or the cache is all pinned
+			journal_abort();
 			free(currentdir);
 			return -1;
 		}
-		fillbitmap((*maindisk).inode[(*tmpfile).inode].toblock[0]); // new sector to include in our bitmap
 		
 		filenode = (*tmpfile).inode; // set our new file inode to the one just created	
+		if (journal_end()) {
+			free(currentdir);
+			return -1;
+		}
 	}
 
 	// look through table for first empty, set it to int file inode and return index of array
@@ -479,9 +882,15 @@ int sfs_fclose(int fileID) {
 			return -1;
 
 	if ( (*mainfptab).fptab[i] != 0 ) {
+		int hr = fd_flush(i); // the buffered data goes out even if it fails, the descriptor is closed anyway
+		free((*mainfptab).wbuf[i]);
+		(*mainfptab).wbuf[i] = NULL;
 		(*mainfptab).fptab[i] = 0;
 		(*mainfptab).pos[i] = 0; //set our position back to zero
-		return 0;
+		(*mainfptab).ranext[i] = 0;
+		(*mainfptab).rawin[i] = 0;
+		(*mainfptab).raend[i] = 0;
+		return hr;
 	}
     return -1;
 } /* !sfs_fclose */
@@ -497,31 +906,19 @@ int sfs_fclose(int fileID) {
  *
  */
 int sfs_fread(int fileID, char *buffer, int length) {
-    // grab the inode from the file table
+    // grab the position from the file table
 		int i = fileID - 1;
 		
 		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
 			return -1;
-
-		int inode;
-		if ( (inode = (*mainfptab).fptab[i]) == 0)
-			return -1;
 		
-		// check paramaters for trickery
-		if (((*mainfptab).pos[i] + length > (*maindisk).inode[inode].size)) // rescale the length to fit within bounds
-			length = (*maindisk).inode[inode].size - (*mainfptab).pos[i];
-		if (length <= 0)
+		if ((length = sfs_pread(fileID, buffer, length, (*mainfptab).pos[i])) == -1)
 			return -1;
-			
-		void* thisfile = inode_read(inode);
-		
-		memcpy(buffer, thisfile + (*mainfptab).pos[i], length); // copying file from the current read/write position into buffer by length
 		
+		file_readahead(i, length);
 		// and set the new pos
 		(*mainfptab).pos[i] += length;
 		
-		free(thisfile);
-		
 		return length;
 }
 
@@ -536,282 +933,3341 @@ int sfs_fread(int fileID, char *buffer, int length) {
  *
  */
 int sfs_fwrite(int fileID, char *buffer, int length) {
-		// grab the inode from the file table
+		// grab the position from the file table
 		int i = fileID - 1;
+		int inode, pos;
 
 		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
 			return -1;
-		
-		int inode;
+		if (readonly) // a snapshot is mounted
+			return -1;
 		if ( (inode = (*mainfptab).fptab[i]) == 0)
 			return -1;
 		
-		// check for trickery
-		if (length <= 0)
+		pos = (*mainfptab).pos[i];
+		if (length <= 0 || length > 0x7fffffff - pos) // check for trickery
 			return -1;
 		
-		void *thisfile = inode_read(inode); // the data stream of the file initially on the disk
-		
-		// 2 cases 
-		// Case 1: r/w pos + length <= numsectors * SECTORSIZE
-		if ((*mainfptab).pos[i] + length <= (*maindisk).inode[inode].numsector * SD_SECTORSIZE) {
-			memcpy(thisfile + (*mainfptab).pos[i], buffer, length); // copy buffer to the file 
-			inode_write(inode, thisfile); // write back to disk
-			
-			(*mainfptab).pos[i] += length;
-			(*maindisk).inode[inode].size = ((*mainfptab).pos[i] > (*maindisk).inode[inode].size)? (*mainfptab).pos[i] : (*maindisk).inode[inode].size;
-			free(thisfile);
-			return length;
+		if (length >= WBUFSIZE) { // big enough to go to the disk on its own, sfs_pwrite flushes what is buffered first
+			if ((length = sfs_pwrite(fileID, buffer, length, pos)) == -1)
+				return -1;
 		}
-		
-		// Case 2: r/w pos + length > numsectors * SECTORSIZE
 		else {
-			int newnumsector = (((*mainfptab).pos[i] + length) / SD_SECTORSIZE ) + 1;
-			while (1) {
-				if ((*maindisk).inode[inode].numsector == newnumsector)
-					break;
-				
-				if (inode_append(inode)) // append the new sector onto our inode_append, which also increases numsector
+			if (wbowner[inode] != -1 && wbowner[inode] != i) // another descriptor of the file is buffering
+				if (fd_flush(wbowner[inode]))
 					return -1;
-			}
-			
-			// now we should have enough space
-			// malloc a new temporary file
-			void *tempfile = malloc((*maindisk).inode[inode].numsector * SD_SECTORSIZE);
-			
-			// now copy the old memory to the new malloc'ed file
-			memcpy(tempfile, thisfile, (*maindisk).inode[inode].size);
-			free(thisfile);
-			thisfile = tempfile;
-			
-			memcpy(thisfile + (*mainfptab).pos[i], buffer, length); // copy buffer to the file 
-			inode_write(inode, thisfile); // write back to disk
-			(*mainfptab).pos[i] += length;
-			int prevsize = (*maindisk).inode[inode].size;
-			(*maindisk).inode[inode].size = (*mainfptab).pos[i];
-			
-			free(thisfile);
-			return (((*maindisk).inode[inode].size - prevsize) > length)?((*maindisk).inode[inode].size - prevsize):length;
+			if ((*mainfptab).wblen[i] > 0 && (pos < (*mainfptab).wbpos[i] || pos > (*mainfptab).wbpos[i] + (*mainfptab).wblen[i]
+					|| pos + length > (*mainfptab).wbpos[i] + WBUFSIZE)) // it doesn't continue what is buffered
+				if (fd_flush(i))
+					return -1;
+			if ((*mainfptab).wbuf[i] == NULL && ((*mainfptab).wbuf[i] = malloc(WBUFSIZE)) == NULL)
+				return -1;
+			if ((*mainfptab).wblen[i] == 0)
+				(*mainfptab).wbpos[i] = pos;
+			memcpy((*mainfptab).wbuf[i] + pos - (*mainfptab).wbpos[i], buffer, length);
+			if (pos + length - (*mainfptab).wbpos[i] > (*mainfptab).wblen[i])
+				(*mainfptab).wblen[i] = pos + length - (*mainfptab).wbpos[i];
+			wbowner[inode] = i;
+			if ((*mainfptab).wblen[i] == WBUFSIZE && fd_flush(i)) // full
+				return -1;
 		}
-		return -1;
+		
+		(*mainfptab).pos[i] += length;
+		return length;
 } /* !sfs_fwrite */
 
 /*
- * sfs_lseek: reposition the offset of the file descriptor 
- *   fileID to position
+ * sfs_pread: attempts to read up to length bytes at offset from file
+ *   descriptor fileID into the buffer starting at buffer. The position
+ *   of fileID is neither used nor changed, so many readers can share
+ *   one file descriptor.
  *
- * Parameters: file descriptor and new position
+ * Parameters: file descriptor, buffer to read, its lenght and the offset
+ *   in the file to read from
  *
- * Returns: Upon successful completion, lseek returns the resulting
- *   offset location, otherwise the value -1 is returned
+ * Returns: on success, the number of bytes read are returned. On
+ *   error, -1 is returned
  *
  */
-int sfs_lseek(int fileID, int position) {
+int sfs_pread(int fileID, char *buffer, int length, int offset) {
     // grab the inode from the file table
 		int i = fileID - 1;
-
+		
 		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
 			return -1;
-		
+
 		int inode;
 		if ( (inode = (*mainfptab).fptab[i]) == 0)
 			return -1;
 		
 		// check paramaters for trickery
-		if (position <= 0 || position >= (*maindisk).inode[inode].size)
+		if (offset < 0)
+			return -1;
+		if (file_flush(inode))
+			return -1;
+		if (length > (*maindisk).inode[inode].size - offset) // rescale the length to fit within bounds
+			length = (*maindisk).inode[inode].size - offset;
+		if (length <= 0)
 			return -1;
 		
-		// and set the new pos
-		(*mainfptab).pos[i] = position;
+		if (file_read(inode, buffer, offset, length) == -1)
+			return -1;
 		
-		return position;
-} /* !sfs_lseek */
+		return length;
+} /* !sfs_pread */
 
 /*
- * sfs_rm: removes a file in the current directory by name if it exists.
+ * sfs_pwrite: writes up to length bytes at offset to the file
+ *   referenced by fileID from the buffer starting at buffer. The
+ *   position of fileID is neither used nor changed.
  *
- * Parameters: file name
+ * Parameters: file descriptor, buffer to write, its lenght and the
+ *   offset in the file to write to
+ *
+ * Returns: on success, the number of bytes written are returned. On
+ *   error, -1 is returned
  *
- * Returns: 0 on success, or -1 if an error occurred
  */
-int sfs_rm(char *file_name) {
-	void* thisdir = inode_read(cwd);
-	file_t* tmpfile = thisdir;
-	
-	//	find the file within the cwd
-	void* tmpend = (*maindisk).inode[cwd].numsector * SD_SECTORSIZE + thisdir - sizeof(file_t);//	the last file
-	while(1){
-		tmpfile = (void*)tmpfile + sizeof(file_t);
+int sfs_pwrite(int fileID, char *buffer, int length, int offset) {
+		// grab the inode from the file table
+		int i = fileID - 1;
+
+		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+			return -1;
+		if (readonly) // a snapshot is mounted
+			return -1;
 		
-		if(((void*)tmpfile >= tmpend) || ((*tmpfile).name[0] == 0)){
-			//	404 not found
-			free(thisdir);
+		int inode;
+		if ( (inode = (*mainfptab).fptab[i]) == 0)
 			return -1;
-		}
-		if(strcmp((*tmpfile).name, file_name) == 0){
-			break;
-		}
-	}
-
-	//    erase the inode
-	inode_erase((*tmpfile).inode);
-	
-	strcpy((*tmpfile).name, ".");
-	(*tmpfile).inode = cwd;
-	
-	//	write back the current working dir
-	inode_write(cwd, thisdir);
 		
-	free(thisdir);
+		// check for trickery
+		if (offset < 0 || length <= 0)
+			return -1;
+		
+		if (length > 0x7fffffff - offset) // the end would not fit in an int
+			return -1;
+		if (file_flush(inode))
+			return -1;
+		
+		if (file_write(inode, buffer, offset, length) == -1)
+			return -1;
+		
+		return length;
+} /* !sfs_pwrite */
+
+/*
+ * sfs_mapread: zero-copy read. Instead of copying, hand out read-only
+ *   views of up to length bytes at offset, straight from the block
+ *   cache, one span per sector. The sectors stay pinned in the cache
+ *   until the spans are given back with sfs_unmap; writes to the file
+ *   meanwhile show through them. Holes are views of a shared zero
+ *   sector. The position of fileID is neither used nor changed.
+ *
+ * Parameters: file descriptor, offset and length of the range, array
+ *   of spans to fill in and its lenght
+ *
+ * Returns: on success, the number of spans filled in, which may cover
+ *   less than length if maxspans or the cache runs out. On error, -1
+ *   is returned
+ *
+ */
+int sfs_mapread(int fileID, int offset, int length, sfs_span_t* spans, int maxspans) {
+		int i = fileID - 1;
+		int inode, n, off, len, sector, tmpinode, numspans = 0;
+		cache_t* entry;
+		
+		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+			return -1;
+		if ( (inode = (*mainfptab).fptab[i]) == 0)
+			return -1;
+		if (offset < 0 || spans == NULL || maxspans <= 0)
+			return -1;
+		if (file_flush(inode))
+			return -1;
+		if (length > (*maindisk).inode[inode].size - offset) // rescale the length to fit within bounds
+			length = (*maindisk).inode[inode].size - offset;
+		if (length <= 0)
+			return -1;
+		
+		if ((*maindisk).inode[inode].numsector == 0) { // the data is kept inside the inode
+			spans[0].base = (char*)(*maindisk).inode[inode].toblock + offset;
+			spans[0].len = length;
+			spans[0].sector = 0;
+			return 1;
+		}
+		n = offset / SD_SECTORSIZE;
+		off = offset % SD_SECTORSIZE;
+		tmpinode = inode_walk(inode, n);
+		pthread_mutex_lock(&cachelock);
+		while (length > 0 && numspans < maxspans) {
+			len = (SD_SECTORSIZE - off < length)? SD_SECTORSIZE - off : length;
+			sector = (*maindisk).inode[tmpinode].toblock[n%7];
+			if (sector == 0) { // a hole
+				spans[numspans].base = zerosector + off;
+			}
+			else {
+				if ((entry = cache_get(sector, 1)) == NULL) // everything is pinned already
+					break;
+				(*entry).pin++;
+				spans[numspans].base = (*entry).data + off;
+			}
+			spans[numspans].len = len;
+			spans[numspans].sector = sector;
+			numspans++;
+			length -= len;
+			off = 0;
+			n++;
+			if (n%7 == 0 && length > 0)
+				tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		pthread_mutex_unlock(&cachelock);
+		
+		return (numspans > 0)? numspans : -1;
+} /* !sfs_mapread */
+
+/*
+ * sfs_unmap: give back spans handed out by sfs_mapread, unpinning
+ *   their sectors
+ *
+ * Parameters: array of spans and its lenght
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ *
+ */
+int sfs_unmap(sfs_span_t* spans, int numspans) {
+		int i, slot;
+		
+		if (spans == NULL || numspans < 0)
+			return -1;
+		pthread_mutex_lock(&cachelock);
+		for (i = 0; i < numspans; ++i) {
+			if (spans[i].sector <= 0 || spans[i].sector >= SD_NUMSECTORS)
+				continue;
+			slot = cachemap[spans[i].sector];
+			if (slot != -1 && maincache[slot].pin > 0)
+				maincache[slot].pin--;
+		}
+		pthread_mutex_unlock(&cachelock);
+		return 0;
+} /* !sfs_unmap */
+
+/*
+ * sfs_readv: the same as sfs_fread, scattering the data into iovcnt
+ *   buffers in one pass over the file's sectors
+ *
+ * Parameters: file descriptor, array of buffers and its lenght
+ *
+ * Returns: on success, the number of bytes read are returned. On
+ *   error, -1 is returned
+ *
+ */
+int sfs_readv(int fileID, sfs_iovec_t* iov, int iovcnt) {
+		int i = fileID - 1;
+		int inode, length, total, pos;
+		
+		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+			return -1;
+		if ( (inode = (*mainfptab).fptab[i]) == 0)
+			return -1;
+		if (iov == NULL || iovcnt <= 0 || (total = iov_length(iov, iovcnt)) <= 0)
+			return -1;
+		if (file_flush(inode))
+			return -1;
+		
+		pos = (*mainfptab).pos[i];
+		length = (*maindisk).inode[inode].size - pos; // rescale the length to fit within bounds
+		if (length > total)
+			length = total;
+		if (length <= 0)
+			return -1;
+		
+		if (file_readv(inode, iov, iovcnt, pos, length) == -1)
+			return -1;
+		
+		file_readahead(i, length);
+		(*mainfptab).pos[i] += length;
+		return length;
+} /* !sfs_readv */
+
+/*
+ * sfs_writev: the same as sfs_fwrite, gathering the data from iovcnt
+ *   buffers so that the whole batch is one pass over the file's sectors
+ *   and every sector is written once
+ *
+ * Parameters: file descriptor, array of buffers and its lenght
+ *
+ * Returns: on success, the number of bytes written are returned. On
+ *   error, -1 is returned
+ *
+ */
+int sfs_writev(int fileID, sfs_iovec_t* iov, int iovcnt) {
+		int i = fileID - 1;
+		int inode, total;
+		
+		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+			return -1;
+		if (readonly) // a snapshot is mounted
+			return -1;
+		if ( (inode = (*mainfptab).fptab[i]) == 0)
+			return -1;
+		if (iov == NULL || iovcnt <= 0 || (total = iov_length(iov, iovcnt)) <= 0)
+			return -1;
+		if (total > 0x7fffffff - (*mainfptab).pos[i]) // the end would not fit in an int
+			return -1;
+		if (file_flush(inode))
+			return -1;
+		
+		if (file_writev(inode, iov, iovcnt, (*mainfptab).pos[i]) == -1)
+			return -1;
+		
+		(*mainfptab).pos[i] += total;
+		return total;
+} /* !sfs_writev */
+
+/*
+ * sfs_lseek: reposition the offset of the file descriptor 
+ *   fileID to position
+ *
+ * Parameters: file descriptor and new position
+ *
+ * Returns: Upon successful completion, lseek returns the resulting
+ *   offset location, otherwise the value -1 is returned
+ *
+ */
+int sfs_lseek(int fileID, int position) {
+    // grab the inode from the file table
+		int i = fileID - 1;
+
+		if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+			return -1;
+		
+		int inode;
+		if ( (inode = (*mainfptab).fptab[i]) == 0)
+			return -1;
+		
+		// check paramaters for trickery, seeking pass the end is fine, a write there leaves a hole
+		if (position < 0)
+			return -1;
+		
+		// and set the new pos
+		(*mainfptab).pos[i] = position;
+		
+		return position;
+} /* !sfs_lseek */
+
+/*
+ * sfs_rm: removes a file in the current directory by name if it exists.
+ *
+ * Parameters: file name
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_rm(char *file_name) {
+	void* thisdir = inode_read(cwd);
+	file_t* tmpfile = thisdir;
+	if(thisdir == NULL || readonly){
+		free(thisdir);
+		return -1;
+	}
+	
+	//	find the file within the cwd
+	void* tmpend = (*maindisk).inode[cwd].numsector * SD_SECTORSIZE + thisdir - sizeof(file_t);//	the last file
+	while(1){
+		tmpfile = (void*)tmpfile + sizeof(file_t);
+		
+		if(((void*)tmpfile >= tmpend) || ((*tmpfile).name[0] == 0)){
+			//	404 not found
+			free(thisdir);
+			return -1;
+		}
+		if(strcmp((*tmpfile).name, file_name) == 0){
+			break;
+		}
+	}
+
+	//    erase the inode
+	if(journal_room(JCHANGE((*maindisk).inode[(*tmpfile).inode].numsector))){
+		free(thisdir);
+		return -1;
+	}
+	file_discard((*tmpfile).inode);
+	inode_erase((*tmpfile).inode);
+	
+	strcpy((*tmpfile).name, ".");
+	(*tmpfile).inode = cwd;
+	
+	//	write back the current working dir
+	if(inode_write(cwd, thisdir)){
+		journal_end();
+		free(thisdir);
+		return -1;
+	}
+	if(journal_end()){
+		free(thisdir);
+		return -1;
+	}
+		
+	free(thisdir);
 	return 0;
 //return -1;
 } /* !sfs_rm */
 
-void fillbitmap(int sector){
-	unsigned char* bitmap=(*maindisk).bitmap;
-	bitmap[sector/8] |= (1<<(sector%8));
+/*
+ * sfs_rm_recursive: remove a file or a dir with everything beneath it.
+ *   The subtree is walked depth first and known whole before anything is
+ *   freed; then it is taken apart from the bottom up, each file and each
+ *   dir once it is empty leaving with its entry in one transaction, so a
+ *   crash part way keeps a smaller tree and never an entry naming a freed
+ *   inode. The last group is committed before it returns.
+ *
+ * Parameters: the name of the file or dir within the cwd
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_rm_recursive(char* name) {
+	void* thisdir;
+	void* tmpend;
+	file_t* tmpfile;
+	file_t entry;
+	dircur_t dir;
+	char* seen;
+	char (*names)[17];
+	int *stack, *list, *parent;
+	int i, top, inode, slot, file, hr = 0, numlist = 0;
+	
+	if (name == NULL || name[0] == 0 || readonly || !strcmp(name, ".") || !strcmp(name, ".."))
+		return -1;
+	if ((inode = dir_lookup(cwd, name)) == -1)
+		return -1;
+	
+	stack = malloc(3 * MAXINODE * sizeof(int));
+	seen = calloc(MAXINODE, 1);
+	names = malloc(MAXINODE * sizeof(*names));
+	if (stack == NULL || seen == NULL || names == NULL) {
+		free(stack);
+		free(seen);
+		free(names);
+		return -1;
+	}
+	list = stack + MAXINODE;
+	parent = stack + 2 * MAXINODE;
+	
+	// the whole subtree first, a corrupt dir leaves everything as it was
+	top = 0;
+	stack[top++] = inode;
+	seen[inode] = 1;
+	parent[inode] = cwd;
+	strncpy(names[inode], name, 17);
+	while (top > 0) {
+		inode = stack[--top];
+		list[numlist++] = inode;
+		if ((*maindisk).inode[inode].status != 1)
+			continue;
+		dir_open(&dir, inode);
+		while ((slot = dir_next(&dir, &entry)) != -1) {
+			if (slot < 2 || !strcmp(entry.name, ".")) // "." and "..", or removed by sfs_rm
+				continue;
+			if (entry.inode <= 0 || entry.inode >= MAXINODE || seen[entry.inode])
+				continue; // not ours to free twice, fsck's business
+			seen[entry.inode] = 1;
+			if ((*maindisk).inode[entry.inode].status == 1) { // the files go with the dir holding them
+				parent[entry.inode] = inode;
+				strncpy(names[entry.inode], entry.name, 17);
+				stack[top++] = entry.inode;
+			}
+		}
+		if (dir.sector == -1) {
+			free(stack);
+			free(seen);
+			free(names);
+			return -1;
+		}
+	}
+	
+	// then from the bottom up, every dir comes after the dirs beneath it
+	for (i = numlist - 1; i >= 0 && hr == 0; --i) {
+		inode = list[i];
+		if ((*maindisk).inode[inode].status == 1) {
+			if ((thisdir = inode_read(inode)) == NULL) {
+				hr = -1;
+				break;
+			}
+			tmpend = (*maindisk).inode[inode].numsector * SD_SECTORSIZE + thisdir;
+			for (tmpfile = thisdir + 2 * sizeof(file_t); (void*)tmpfile < tmpend && (*tmpfile).name[0] != 0 && hr == 0; ++tmpfile) {
+				file = (*tmpfile).inode;
+				if (!strcmp((*tmpfile).name, ".") || file <= 0 || file >= MAXINODE || (*maindisk).inode[file].status != 2)
+					continue; // removed, or a dir that already left
+				// the header sectors freeing the file touches, and every sector of the dir inode_write logs
+				if (journal_room(JCHANGE((*maindisk).inode[file].numsector) + (*maindisk).inode[inode].numsector)) {
+					hr = -1;
+					break;
+				}
+				file_discard(file);
+				inode_erase(file);
+				strcpy((*tmpfile).name, ".");
+				(*tmpfile).inode = inode;
+				hr = inode_write(inode, thisdir);
+				if (journal_end())
+					hr = -1;
+			}
+			free(thisdir);
+			if (hr)
+				break;
+		}
+		if (journal_room(JCHANGE((*maindisk).inode[inode].numsector) + (*maindisk).inode[parent[inode]].numsector)) {
+			hr = -1;
+			break;
+		}
+		file_discard(inode);
+		inode_erase(inode);
+		hr = dir_set(parent[inode], names[inode], ".", parent[inode]); // removed, as sfs_rm leaves it
+		if (journal_end())
+			hr = -1;
+	}
+	if (journal_commit())
+		hr = -1;
+	free(stack);
+	free(seen);
+	free(names);
+	return hr;
+} /* !sfs_rm_recursive */
+
+/*
+ * sfs_rename: give a file or dir a new name, in the same dir or in
+ *   another one, without touching its data: only the entries of the two
+ *   dirs change, and the ".." of a dir that moves. A file already there
+ *   under the new name is replaced. It all goes in one journal group, so
+ *   after a crash the file has either its old name or its new one, and a
+ *   failure part way drops the group, leaving everything as it was.
+ *
+ * Parameters: the old and the new path, relative to the cwd or absolute
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_rename(char* oldpath, char* newpath) {
+	char oldname[17], newname[17];
+	int olddir, newdir, inode, target, up, n, hr;
+	
+	if (oldpath == NULL || newpath == NULL || readonly)
+		return -1;
+	if ((olddir = path_parent(oldpath, oldname)) == -1 || (newdir = path_parent(newpath, newname)) == -1)
+		return -1;
+	if (!strcmp(oldname, ".") || !strcmp(oldname, "..") || !strcmp(newname, ".") || !strcmp(newname, ".."))
+		return -1;
+	if ((inode = dir_lookup(olddir, oldname)) == -1 || (*maindisk).inode[newdir].status != 1)
+		return -1;
+	target = dir_lookup(newdir, newname);
+	if (target == inode) // the same entry, or both names already the same file
+		return 0;
+	if (target != -1 && ((*maindisk).inode[inode].status != 2 || (*maindisk).inode[target].status != 2))
+		return -1; // only a file may take the place of a file
+	if ((*maindisk).inode[inode].status == 1) { // a dir can't go inside itself
+		for (up = newdir, n = 0; up != 0; up = dir_lookup(up, ".."), ++n) {
+			if (up == inode || up == -1 || n == MAXINODE)
+				return -1;
+		}
+	}
+	if (sfs_sync()) // the group holds this rename only, and nothing of it reaches the disk before the commit
+		return -1;
+	
+	if (target != -1) // the new name takes the place of the old file
+		hr = dir_set(newdir, newname, newname, inode);
+	else if (olddir == newdir)
+		hr = dir_set(olddir, oldname, newname, inode);
+	else
+		hr = dir_set(newdir, NULL, newname, inode);
+	if (hr == 0 && (olddir != newdir || target != -1))
+		hr = dir_set(olddir, oldname, ".", olddir); // removed, as sfs_rm leaves it
+	if (hr == 0 && olddir != newdir && (*maindisk).inode[inode].status == 1)
+		hr = dir_set(inode, "..", "..", newdir);
+	if (hr) { // a dir couldn't grow or a shared sector couldn't be copied, what was done goes too
+		journal_abort();
+		return -1;
+	}
+	if (target != -1) { // only once both entries are written
+		file_discard(target);
+		inode_erase(target);
+	}
+	return journal_commit();
+} /* !sfs_rename */
+
+/*
+ * sfs_stat: get the size, type and sector usage of a file or directory
+ *   by name. Only directory and inode metadata is read.
+ *
+ * Parameters: file or directory name, relative to the cwd or absolute,
+ *   and the structure to fill in
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_stat(char* name, sfs_stat_t* st) {
+	int inode;
+	
+	if(name == NULL || st == NULL || name[0] == 0){
+		return -1;
+	}
+	if((inode = path_lookup(name)) == -1){
+		return -1;
+	}
+	if(file_flush(inode)){
+		return -1;
+	}
+	inode_stat(inode, st);
+	return 0;
+} /* !sfs_stat */
+
+/*
+ * sfs_fstat: the same as sfs_stat, for an opened file descriptor
+ *
+ * Parameters: file descriptor and the structure to fill in
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_fstat(int fileID, sfs_stat_t* st) {
+	int i = fileID - 1;
+	
+	if (i < 0 || i > MAXFPTAB - 1 || st == NULL) // don't allow out of bounds array checks
+		return -1;
+	if ((*mainfptab).fptab[i] == 0)
+		return -1;
+	if (file_flush((*mainfptab).fptab[i]))
+		return -1;
+	inode_stat((*mainfptab).fptab[i], st);
+	return 0;
+} /* !sfs_fstat */
+
+/*
+ * sfs_fallocate: reserve sectors for [offset, offset + length) of a
+ *   file up front, as one run of contiguous sectors when the bitmap has
+ *   one, so that later writes there land next to each other. Nothing is
+ *   written and the size does not change, except that reserved sectors
+ *   under the current size are zeroed since they were holes.
+ *
+ * Parameters: file descriptor, offset and length of the range
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_fallocate(int fileID, int offset, int length) {
+	int i = fileID - 1;
+	int inode, tmpinode, n, first, last, numhole, sector = 0, run = 0;
+	char zero[SD_SECTORSIZE] = "";
+	
+	if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+		return -1;
+	if (readonly) // a snapshot is mounted
+		return -1;
+	if ((inode = (*mainfptab).fptab[i]) == 0)
+		return -1;
+	if (offset < 0 || length <= 0 || length > 0x7fffffff - offset)
+		return -1;
+	if (file_flush(inode))
+		return -1;
+	first = offset / SD_SECTORSIZE;
+	last = (offset + length - 1) / SD_SECTORSIZE;
+	n = ((*maindisk).inode[inode].numsector < first) ? (*maindisk).inode[inode].numsector : first;
+	if (journal_room(JCHANGE(last + 1 - n))) // the sectors it reserves, and the holes it maps before them
+		return -1;
+	
+	if ((*maindisk).inode[inode].numsector == 0) { // the data can't stay inside the inode once it has sectors
+		if ((*maindisk).inode[inode].size > 0) {
+			if (inode_uninline(inode))
+				return -1;
+		}
+		else {
+			memset((*maindisk).inode[inode].toblock, 0, INLINESIZE);
+		}
+	}
+	if (inode_extend(inode, last + 1))
+		return -1;
+	
+	// count the holes first, so the whole reservation can be asked for as one run
+	numhole = 0;
+	for (n = first; n <= last; ++n) {
+		if (inode_getsector(inode, n) == 0)
+			numhole++;
+	}
+	
+	tmpinode = inode_walk(inode, first);
+	for (n = first; n <= last; ++n) {
+		if (n != first && n%7 == 0)
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		if ((*maindisk).inode[tmpinode].toblock[n%7] != 0)
+			continue;
+		if (run == 0) { // take the next run of free sectors
+			if ((sector = findanemptyrun(inode_goal(inode), numhole, &run)) == -1)
+				return -1;
+		}
+		fillbitmap(sector);
+		(*maindisk).inode[tmpinode].toblock[n%7] = sector;
+		if (n * SD_SECTORSIZE < (*maindisk).inode[inode].size) // it was a hole, it must still read as zeros
+			sector_write(sector, zero);
+		sector++;
+		run--;
+		numhole--;
+	}
+	return journal_end();
+} /* !sfs_fallocate */
+
+/*
+ * sfs_truncate: cut the named file to length bytes, freeing the sectors
+ *   and chained inodes after the new end, or grow it with a hole
+ *
+ * Parameters: file name, relative to the cwd or absolute, and new length
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_truncate(char* name, int length) {
+	int inode;
+	
+	if(name == NULL || name[0] == 0 || length < 0 || readonly){
+		return -1;
+	}
+	if((inode = path_lookup(name)) == -1){
+		return -1;
+	}
+	if((*maindisk).inode[inode].status != 2){//	only a file can be truncated
+		return -1;
+	}
+	if(file_flush(inode)){
+		return -1;
+	}
+	if(file_truncate(inode, length)){
+		return -1;
+	}
+	return journal_end();
+} /* !sfs_truncate */
+
+/*
+ * sfs_ftruncate: the same as sfs_truncate, for an opened file
+ *   descriptor. Its position is left alone.
+ *
+ * Parameters: file descriptor and new length
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_ftruncate(int fileID, int length) {
+	int i = fileID - 1;
+	
+	if (i < 0 || i > MAXFPTAB - 1 || length < 0) // don't allow out of bounds array checks
+		return -1;
+	if (readonly) // a snapshot is mounted
+		return -1;
+	if ((*mainfptab).fptab[i] == 0)
+		return -1;
+	if (file_flush((*mainfptab).fptab[i]))
+		return -1;
+	if (file_truncate((*mainfptab).fptab[i], length))
+		return -1;
+	return journal_end();
+} /* !sfs_ftruncate */
+
+/*
+ * sfs_fsync: make a file durable. The data sfs_fwrite is holding back
+ *   for the file descriptor is written out first, then the running
+ *   journal group is committed, so that sfs_mount finds the file as it
+ *   is now. Small writes are gathered in
+ *   a per descriptor buffer and only get their sectors when it is full,
+ *   the file is closed or read, or here.
+ *
+ * Parameters: file descriptor
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_fsync(int fileID) {
+	int i = fileID - 1;
+	int hr;
+	
+	if (i < 0 || i > MAXFPTAB - 1) // don't allow out of bounds array checks
+		return -1;
+	if ((*mainfptab).fptab[i] == 0)
+		return -1;
+	hr = fd_flush(i);
+	if (journal_commit())
+		hr = -1;
+	return hr;
+} /* !sfs_fsync */
+
+/*
+ * sfs_sync: make everything durable. What every file descriptor has
+ *   buffered is written first, then the journal group is committed.
+ *
+ * Parameters: -
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_sync() {
+	int i, hr = 0;
+	
+	for (i = 0; i < MAXFPTAB; ++i) {
+		if ((*mainfptab).wblen[i] > 0 && fd_flush(i))
+			hr = -1;
+	}
+	if (journal_commit())
+		hr = -1;
+	return hr;
+} /* !sfs_sync */
+
+/*
+ * sfs_fsck: check the mounted filesystem. The inode table is split in
+ *   ranges checked by numthreads threads: every toinode chain is walked,
+ *   the sectors it uses are claimed atomically to find cross-links, and
+ *   every sector with a checksum is read back and verified. Once all of
+ *   that is done, a second pass checks every dir's entries, "." and "..".
+ *   Where several inodes claim the same thing the lowest wins, so the
+ *   result doesn't depend on how the threads ran. The bitmap is then
+ *   compared with the sectors found in use. Each problem is one line of
+ *   the form "problem key=value ...", followed by a summary line, in the
+ *   same order whatever numthreads is.
+ *
+ * Parameters: where to report, and how many threads to use
+ *
+ * Returns: the number of problems found, or -1 if an error occurred
+ */
+int sfs_fsck(FILE* f, int numthreads) {
+	fsck_t* ck;
+	pthread_t thread[MAXFSCKTHREAD];
+	int datastart = JSTART + JOURNALSIZE;
+	int i, j, marked, status, problems = 0, numdir = 0, numfile = 0, used = 0;
+	
+	if (f == NULL || maindisk == 0 || numthreads < 1)
+		return -1;
+	if (numthreads > MAXFSCKTHREAD)
+		numthreads = MAXFSCKTHREAD;
+	if ((ck = malloc(sizeof(fsck_t))) == NULL)
+		return -1;
+	for (i = 0; i < SD_NUMSECTORS; ++i) {
+		(*ck).owner[i] = -1;
+		(*ck).other[i] = -1;
+		(*ck).uses[i] = 0;
+		(*ck).badcsum[i] = 0;
+		(*ck).snapcopy[i] = 0;
+	}
+	for (i = 0; i < MAXSNAP; ++i) {
+		for (j = 0; (*snaptab).snap[i].name[0] != 0 && j < (*snaptab).snap[i].numsector; ++j)
+			(*ck).snapcopy[(*snaptab).snap[i].start + j] = 1;
+	}
+	for (i = 0; i < MAXINODE; ++i) {
+		(*ck).chainof[i] = -1;
+		(*ck).links[i] = 0;
+		(*ck).parent[i] = -1;
+		(*ck).dotdot[i] = -1;
+		(*ck).flags[i] = 0;
+	}
+	(*ck).links[0] = 1; // the root is linked from the disk itself
+	(*ck).parent[0] = 0;
+	
+	// the dirs are read only once every sector is claimed, which dirs are sane must not depend on the threads
+	for ((*ck).phase = 0; (*ck).phase < 2; ++(*ck).phase) {
+		(*ck).next = 0;
+		for (i = 1; i < numthreads; ++i) {
+			if (pthread_create(&thread[i], NULL, fsck_run, ck)) {
+				numthreads = i;
+				break;
+			}
+		}
+		fsck_run(ck);
+		for (i = 1; i < numthreads; ++i) {
+			pthread_join(thread[i], NULL);
+		}
+	}
+	
+	// everything is known now, report it in order
+	if ((*maindisk).inode[0].status != 1) {
+		fprintf(f, "badroot inode=0 status=%d\n", (*maindisk).inode[0].status);
+		problems++;
+	}
+	for (i = 0; i < MAXINODE; ++i) {
+		status = (*maindisk).inode[i].status;
+		if (status < 0 || status > 3) {
+			fprintf(f, "badstatus inode=%d status=%d\n", i, status);
+			problems++;
+			continue;
+		}
+		if (status == 3 && (*ck).chainof[i] == -1) {
+			fprintf(f, "orphanchain inode=%d\n", i);
+			problems++;
+		}
+		if (status != 1 && status != 2)
+			continue;
+		if (status == 1)
+			numdir++;
+		else
+			numfile++;
+		if ((*ck).flags[i] & FSCK_BADSIZE) {
+			fprintf(f, "badsize inode=%d size=%d numsector=%d\n", i, (*maindisk).inode[i].size, (*maindisk).inode[i].numsector);
+			problems++;
+		}
+		if ((*ck).flags[i] & FSCK_BADSECTOR) {
+			fprintf(f, "badsector inode=%d\n", i);
+			problems++;
+		}
+		if ((*ck).flags[i] & FSCK_BADCHAIN) {
+			fprintf(f, "badchain inode=%d\n", i);
+			problems++;
+		}
+		if ((*ck).flags[i] & FSCK_BADDOT) {
+			fprintf(f, "baddot dir=%d\n", i);
+			problems++;
+		}
+		if ((*ck).flags[i] & FSCK_BADENTRY) {
+			fprintf(f, "badentry dir=%d\n", i);
+			problems++;
+		}
+		if ((*ck).links[i] == 0) {
+			fprintf(f, "orphan inode=%d\n", i);
+			problems++;
+		}
+		else if (status == 1 && (*ck).links[i] > 1) {
+			fprintf(f, "multilinked dir=%d links=%d\n", i, (*ck).links[i]);
+			problems++;
+		}
+		else if (status == 1 && (*ck).dotdot[i] != -1 && (*ck).dotdot[i] != (*ck).parent[i]) {
+			fprintf(f, "baddotdot dir=%d dotdot=%d parent=%d\n", i, (*ck).dotdot[i], (*ck).parent[i]);
+			problems++;
+		}
+	}
+	for (i = 1; i < SD_NUMSECTORS; ++i) {
+		marked = ((*maindisk).bitmap[i/8] & (1<<(i%8))) != 0;
+		if ((*ck).uses[i] > (*snaptab).share[i] + 1) { // more files name it than were given it by sfs_clone
+			fprintf(f, "crosslinked sector=%d inode=%d other=%d\n", i, (*ck).owner[i], (*ck).other[i]);
+			problems++;
+		}
+		else if ((*ck).uses[i] ? (*ck).uses[i] < (*snaptab).share[i] + 1 : (*snaptab).share[i] != 0) {
+			fprintf(f, "badshare sector=%d uses=%d share=%d\n", i, (*ck).uses[i], (*snaptab).share[i]);
+			problems++;
+		}
+		if ((*ck).badcsum[i]) {
+			fprintf(f, "badcsum sector=%d inode=%d\n", i, (*ck).owner[i]);
+			problems++;
+		}
+		if ((*ck).owner[i] != -1) {
+			used++;
+			if (!marked) {
+				fprintf(f, "unmarked sector=%d inode=%d\n", i, (*ck).owner[i]);
+				problems++;
+			}
+		}
+		else if ((i < datastart || (*snaptab).refcnt[i] || (*ck).snapcopy[i]) && !marked) { // the header, the journal and what the snapshots hold
+			fprintf(f, "unmarked sector=%d inode=-1\n", i);
+			problems++;
+		}
+		else if ((*snaptab).refcnt[i] || (*ck).snapcopy[i]) {
+			continue;
+		}
+		else if (i >= datastart && marked) {
+			fprintf(f, "leaked sector=%d\n", i);
+			problems++;
+		}
+	}
+	fprintf(f, "summary dirs=%d files=%d sectors=%d problems=%d threads=%d\n", numdir, numfile, used, problems, numthreads);
+	
+	free(ck);
+	return problems;
+} /* !sfs_fsck */
+
+/*
+ * sfs_crc32c: the CRC32C (Castagnoli) of a buffer, the checksum kept for
+ *   every sector. It uses the SSE4.2 crc32 instruction when the cpu has it
+ *   and tables otherwise; both give the same result.
+ *
+ * Parameters: the CRC of the data before, 0 to start, the data and its
+ *   length in bytes
+ *
+ * Returns: the CRC of everything so far
+ */
+unsigned int sfs_crc32c(unsigned int crc, const void* data, int len) {
+	crc_init();
+	return ~crc32c(~crc, data, len);
+} /* !sfs_crc32c */
+
+/*
+ * sfs_snapshot: take a snapshot of the whole filesystem under name. Only
+ *   the inode table is copied; every sector the files and dirs use is
+ *   shared with the snapshot, counted in a reference count, and copied
+ *   only when the live filesystem writes it next.
+ *
+ * Parameters: the name of the snapshot, shorter than SNAPNAMELEN
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_snapshot(char* name) {
+	int i, slot, last = 0, numsector, start, found;
+	
+	if (name == NULL || name[0] == 0 || strlen(name) >= SNAPNAMELEN || readonly || snap_find(name) != -1)
+		return -1;
+	for (slot = 0; slot < MAXSNAP && (*snaptab).snap[slot].name[0] != 0; ++slot);
+	if (slot == MAXSNAP)
+		return -1;
+	if (sfs_sync()) // buffered writes and the running group go in first
+		return -1;
+	
+	// copy the inodes up to the last one in use, into one run of sectors
+	for (i = 0; i < MAXINODE; ++i) {
+		if ((*maindisk).inode[i].status != 0)
+			last = i;
+	}
+	numsector = ((last + 1) * sizeof(inode_t) + SD_SECTORSIZE - 1) / SD_SECTORSIZE;
+	if ((start = findanemptyrun(1, numsector, &found)) == -1 || found < numsector)
+		return -1;
+	for (i = 0; i < numsector; ++i) {
+		sector_write(start + i, (void*)maindisk + i * SD_SECTORSIZE);
+		fillbitmap(start + i);
+	}
+	
+	// and share everything they point to
+	snap_count((*maindisk).inode, MAXINODE, (*snaptab).refcnt);
+	strcpy((*snaptab).snap[slot].name, name);
+	(*snaptab).snap[slot].start = start;
+	(*snaptab).snap[slot].numsector = numsector;
+	return journal_commit();
+} /* !sfs_snapshot */
+
+/*
+ * sfs_snapdelete: delete a snapshot. The sectors only it still held are
+ *   freed, with its copy of the inode table.
+ *
+ * Parameters: the name of the snapshot
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_snapdelete(char* name) {
+	snap_t* snap;
+	inode_t* table;
+	unsigned short* map;
+	int i, slot, numinode;
+	
+	if (name == NULL || readonly || (slot = snap_find(name)) == -1)
+		return -1;
+	if (journal_commit()) // what it frees may be spread over the whole disk, it takes a group of its own
+		return -1;
+	snap = &(*snaptab).snap[slot];
+	table = malloc((*snap).numsector * SD_SECTORSIZE);
+	map = calloc(2 * SD_NUMSECTORS, sizeof(unsigned short)); // what the snapshot uses, then what the live filesystem uses
+	if (table == NULL || map == NULL) {
+		free(table);
+		free(map);
+		return -1;
+	}
+	for (i = 0; i < (*snap).numsector; ++i) {
+		if (sector_read((*snap).start + i, (void*)table + i * SD_SECTORSIZE)) {
+			free(table);
+			free(map);
+			return -1;
+		}
+	}
+	numinode = (*snap).numsector * SD_SECTORSIZE / sizeof(inode_t);
+	if (numinode > MAXINODE)
+		numinode = MAXINODE;
+	snap_count(table, numinode, map);
+	snap_count((*maindisk).inode, MAXINODE, map + SD_NUMSECTORS);
+	
+	for (i = 1; i < SD_NUMSECTORS; ++i) {
+		if (map[i] == 0 || (*snaptab).refcnt[i] == 0)
+			continue;
+		(*snaptab).refcnt[i] -= (map[i] < (*snaptab).refcnt[i]) ? map[i] : (*snaptab).refcnt[i];
+		if ((*snaptab).refcnt[i] == 0 && map[SD_NUMSECTORS + i] == 0) // nobody has it now
+			emptybitmap(i);
+	}
+	for (i = 0; i < (*snap).numsector; ++i) {
+		emptybitmap((*snap).start + i);
+	}
+	memset(snap, 0, sizeof(snap_t));
+	free(table);
+	free(map);
+	return journal_commit();
+} /* !sfs_snapdelete */
+
+/*
+ * sfs_snapmount: mount a snapshot read only, in place of the live
+ *   filesystem. Open files and dirs are forgotten as with sfs_mount, and
+ *   everything that would change the filesystem fails until sfs_mount
+ *   brings the live filesystem back.
+ *
+ * Parameters: the name of the snapshot
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_snapmount(char* name) {
+	snap_t snap;
+	void* table;
+	int i, size;
+	
+	if (name == NULL || (i = snap_find(name)) == -1)
+		return -1;
+	snap = (*snaptab).snap[i];
+	if (sfs_sync())
+		return -1;
+	if ((table = malloc(snap.numsector * SD_SECTORSIZE)) == NULL)
+		return -1;
+	for (i = 0; i < snap.numsector; ++i) {
+		if (sector_read(snap.start + i, table + i * SD_SECTORSIZE)) {
+			free(table);
+			return -1;
+		}
+	}
+	
+	tables_init();
+	for (i = 0; i < MAXINODE; ++i) {
+		init_inode(&(*maindisk).inode[i]);
+	}
+	size = snap.numsector * SD_SECTORSIZE;
+	if (size > sizeof((*maindisk).inode))
+		size = sizeof((*maindisk).inode);
+	memcpy((*maindisk).inode, table, size);
+	free(table);
+	readonly = 1;
+	cwd = 0;
+	return 0;
+} /* !sfs_snapmount */
+
+/*
+ * sfs_clone: make dst, a new file, a copy of the file src without
+ *   copying its data: dst names the same sectors, and whichever of the
+ *   two is written first moves to a sector of its own there. The new
+ *   entry and the shared mapping go in one journal group, so after a
+ *   crash or a failure part way there is either the whole copy or none.
+ *
+ * Parameters: the path of the file to copy, and the path of the copy,
+ *   relative to the cwd or absolute
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_clone(char* src, char* dst) {
+	char name[17];
+	int inode, clone, dir, n, numsector, sector, tmpinode, tmpclone;
+	
+	if (src == NULL || dst == NULL || readonly || (inode = path_lookup(src)) == -1)
+		return -1;
+	if ((dir = path_parent(dst, name)) == -1 || !strcmp(name, ".") || !strcmp(name, ".."))
+		return -1;
+	if ((*maindisk).inode[inode].status != 2 || dir_lookup(dir, name) != -1)
+		return -1;
+	if (sfs_sync()) // src is flushed, and the group holds this clone only, so a failure can drop it
+		return -1;
+	numsector = (*maindisk).inode[inode].numsector;
+	for (n = 0; n < numsector; ++n) {
+		if ((sector = inode_getsector(inode, n)) != 0 && (*snaptab).share[sector] == MAXSHARE)
+			return -1;
+	}
+	
+	// the new inode and its chain, then the entry, which may grow the dir by one sector, then the mapping of src
+	if (journal_room(JCHANGE(numsector) + (*maindisk).inode[dir].numsector + 1))
+		return -1;
+	if ((clone = findanemptyinode(group_of(dir))) == -1)
+		return -1;
+	(*maindisk).inode[clone].numsector = 0;
+	(*maindisk).inode[clone].status = 2;
+	(*maindisk).inode[clone].size = 0;
+	if (inode_extend(clone, numsector) || dir_set(dir, NULL, name, clone)) {
+		journal_abort();
+		return -1;
+	}
+	if (numsector == 0) // the data is inside the inode
+		memcpy((*maindisk).inode[clone].toblock, (*maindisk).inode[inode].toblock, INLINESIZE);
+	tmpinode = inode;
+	tmpclone = clone;
+	for (n = 0; n < numsector; ++n) {
+		if (n && n%7 == 0) {
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+			tmpclone = (*maindisk).inode[tmpclone].toinode;
+		}
+		sector = (*maindisk).inode[tmpinode].toblock[n%7];
+		(*maindisk).inode[tmpclone].toblock[n%7] = sector;
+		if (sector != 0)
+			(*snaptab).share[sector]++;
+	}
+	(*maindisk).inode[clone].size = (*maindisk).inode[inode].size;
+	return journal_commit();
+} /* !sfs_clone */
+
+/*
+ * sfs_fragstat: measure how fragmented the files and dirs are
+ *
+ * Parameters: the structure to fill in
+ *
+ * Returns: 0 on success, or -1 if an error occurred
+ */
+int sfs_fragstat(sfs_fragstat_t* st) {
+	sfs_stat_t ist;
+	int i, numrun, numgap, seek, totalgap = 0;
+	long long totalseek = 0;
+	
+	if (st == NULL || maindisk == 0)
+		return -1;
+	if (sfs_sync()) // sectors still in write buffers have no place yet
+		return -1;
+	memset(st, 0, sizeof(sfs_fragstat_t));
+	for (i = 0; i < MAXINODE; ++i) {
+		if ((*maindisk).inode[i].status != 1 && (*maindisk).inode[i].status != 2)
+			continue;
+		inode_stat(i, &ist);
+		if (ist.numextent == 0)
+			continue;
+		inode_frag(i, &numrun, &numgap, &seek);
+		(*st).numfile++;
+		(*st).numextent += ist.numextent;
+		if (ist.numextent > numrun)
+			(*st).numfragmented++;
+		totalgap += numgap;
+		totalseek += seek;
+	}
+	if ((*st).numfile > 0)
+		(*st).extentperfile = (double)(*st).numextent / (*st).numfile;
+	if (totalgap > 0)
+		(*st).avgseek = (double)totalseek / totalgap;
+	return 0;
+} /* !sfs_fragstat */
+
+/*
+ * sfs_defrag: run one slice of the defragmenter. Fragmented files and
+ *   dirs are taken in inode order, going on from where the last slice
+ *   stopped, and each is moved whole into a free run of sectors long
+ *   enough for it: its data is copied first, then its new mapping and
+ *   the bitmap are committed in one journal group, so a crash leaves it
+ *   either where it was or where it went. Files sharing sectors with a
+ *   snapshot or a clone, or mapped by sfs_mapread, are left alone.
+ *
+ * Parameters: how many sectors the slice may move; it stops after the
+ *   file that reaches it, so a big file may take it over
+ *
+ * Returns: the number of sectors moved, 0 once a whole pass over the
+ *   inode table finds nothing it can improve, or -1 if an error occurred
+ */
+int sfs_defrag(int maxsectors) {
+	int i, n, moved = 0, hr = 0;
+	
+	if (maxsectors < 1 || readonly || maindisk == 0)
+		return -1;
+	if (sfs_sync())
+		return -1;
+	for (i = 0; i < MAXINODE && moved < maxsectors; ++i) {
+		n = file_relocate(defragnext);
+		defragnext = (defragnext + 1) % MAXINODE;
+		if (n == -1) // a corrupt sector, the file stays where it is and the others go on
+			hr = -1;
+		else
+			moved += n;
+	}
+	return (hr == -1) ? -1 : moved;
+} /* !sfs_defrag */
+
+/*
+ * sfs_mkimage: build a new filesystem holding the given files and dirs,
+ *   in place of whatever the disk held. The whole layout is worked out in
+ *   memory first: entry i gets inode i, and every dir is followed by its
+ *   sectors and then by the data of its files, each in one run. The data
+ *   sectors are then written in one pass from the start of the disk to
+ *   the end, and the header last, with no journal in between.
+ *
+ * Parameters: the files and dirs, every one after its dir, and how many
+ *   there are
+ *
+ * Returns: 0 on success, or -1 if an error occurred or they don't fit
+ */
+int sfs_mkimage(sfs_imgent_t* ents, int numents) {
+	int datastart = JSTART + JOURNALSIZE;
+	int *numentry, *first, *last, *next, *start, *count, *slot;
+	int i, j, n, d, sector, numsector, tmpinode, nextinode;
+	char* image;
+	file_t* entry;
+	
+	if (ents == NULL || numents < 1 || numents > MAXINODE || ents[0].type != 1)
+		return -1;
+	numentry = calloc(7 * numents, sizeof(int));
+	if (numentry == NULL)
+		return -1;
+	first = numentry + numents; // the children of each dir, in array order
+	last = first + numents;
+	next = last + numents;
+	start = next + numents; // where the sectors of each entry go
+	count = start + numents;
+	slot = count + numents; // the next free file_t of each dir
+	for (i = 0; i < numents; ++i) {
+		first[i] = last[i] = next[i] = -1;
+		numentry[i] = 2;
+		slot[i] = 2;
+	}
+	for (i = 1; i < numents; ++i) {
+		d = ents[i].parent;
+		if (d < 0 || d >= i || ents[d].type != 1 || (ents[i].type != 1 && ents[i].type != 2)
+				|| ents[i].name[0] == 0 || strnlen(ents[i].name, 17) > 16 || strchr(ents[i].name, '/') != NULL
+				|| !strcmp(ents[i].name, ".") || !strcmp(ents[i].name, "..") || ents[i].size < 0
+				|| (ents[i].type == 2 && ents[i].size > 0 && ents[i].data == NULL)) {
+			free(numentry);
+			return -1;
+		}
+		for (j = first[d]; j != -1; j = next[j]) {
+			if (!strcmp(ents[j].name, ents[i].name)) { // two entries of a dir with one name
+				free(numentry);
+				return -1;
+			}
+		}
+		numentry[d]++;
+		if (last[d] == -1)
+			first[d] = i;
+		else
+			next[last[d]] = i;
+		last[d] = i;
+	}
+	
+	// every dir, then the data of its files, one after the other
+	sector = datastart;
+	nextinode = numents; // the chain inodes come after the entries
+	for (d = 0; d < numents; ++d) {
+		if (ents[d].type != 1)
+			continue;
+		start[d] = sector;
+		count[d] = dir_sectors(numentry[d]);
+		sector += count[d];
+		for (i = first[d]; i != -1; i = next[i]) {
+			if (ents[i].type != 2 || ents[i].size <= INLINESIZE)
+				continue;
+			start[i] = sector;
+			count[i] = (ents[i].size + SD_SECTORSIZE - 1) / SD_SECTORSIZE;
+			sector += count[i];
+		}
+	}
+	for (i = 0; i < numents; ++i) {
+		if (count[i] > 7)
+			nextinode += (count[i] - 1) / 7;
+	}
+	numsector = sector - datastart;
+	if (sector > SD_NUMSECTORS || nextinode > MAXINODE || (image = calloc(numsector, SD_SECTORSIZE)) == NULL) {
+		free(numentry);
+		return -1;
+	}
+	if (sfs_mkfs()) {
+		free(image);
+		free(numentry);
+		return -1;
+	}
+	
+	// fill the sectors and the inodes
+	nextinode = numents;
+	for (i = 0; i < numents; ++i) {
+		init_inode(&(*maindisk).inode[i]);
+		(*maindisk).inode[i].status = ents[i].type;
+		if (ents[i].type == 1) {
+			entry = (void*)image + (start[i] - datastart) * SD_SECTORSIZE;
+			strcpy(entry[0].name, ".");
+			entry[0].inode = i;
+			strcpy(entry[1].name, "..");
+			entry[1].inode = (i == 0) ? 0 : ents[i].parent;
+		}
+		else {
+			(*maindisk).inode[i].size = ents[i].size;
+			if (ents[i].size <= INLINESIZE)
+				memcpy((*maindisk).inode[i].toblock, ents[i].data, ents[i].size);
+			else
+				memcpy(image + (start[i] - datastart) * SD_SECTORSIZE, ents[i].data, ents[i].size);
+		}
+		if (i > 0) {
+			entry = (void*)image + (start[ents[i].parent] - datastart) * SD_SECTORSIZE;
+			strncpy(entry[slot[ents[i].parent]].name, ents[i].name, 16);
+			entry[slot[ents[i].parent]++].inode = i;
+		}
+		(*maindisk).inode[i].numsector = count[i];
+		tmpinode = i;
+		for (n = 0; n < count[i]; ++n) {
+			if (n && n%7 == 0) {
+				(*maindisk).inode[tmpinode].toinode = nextinode;
+				tmpinode = nextinode++;
+				init_inode(&(*maindisk).inode[tmpinode]);
+				(*maindisk).inode[tmpinode].status = 3;
+			}
+			(*maindisk).inode[tmpinode].toblock[n%7] = start[i] + n;
+			fillbitmap(start[i] + n);
+		}
+	}
+	
+	// one pass over the data, then the header
+	for (j = 0; j < numsector; ++j) {
+		csumtab[datastart + j] = csum_of(image + j * SD_SECTORSIZE);
+		while (SD_write(datastart + j, image + j * SD_SECTORSIZE));
+	}
+	meta_sync();
+	cache_init(); // it holds the root as sfs_mkfs wrote it
+	cwd = 0;
+	free(image);
+	free(numentry);
+	return 0;
+} /* !sfs_mkimage */
+
+/*
+ * sfs_readimage: read every file and dir of the mounted filesystem, the
+ *   reverse of sfs_mkimage. The tree is walked from the root, dir by dir,
+ *   then the data of all the files is read in one pass in the order of
+ *   the sectors on the disk, whichever file each belongs to, and checked
+ *   against its checksum.
+ *
+ * Parameters: where to return the array of entries, in the order
+ *   sfs_mkimage takes them; the array and the data of every entry are
+ *   allocated and the caller frees them
+ *
+ * Returns: the number of entries, or -1 if an error occurred or a dir or
+ *   a sector is corrupt
+ */
+int sfs_readimage(sfs_imgent_t** ents) {
+	sfs_imgent_t* list;
+	readreq_t* req;
+	dircur_t dir;
+	file_t entry;
+	char data[SD_SECTORSIZE];
+	int *inodes;
+	int i, n, len, slot, tmpinode, numents = 1, numreq = 0;
+	
+	if (ents == NULL || maindisk == 0)
+		return -1;
+	if (sfs_sync()) // every byte written so far is on the disk
+		return -1;
+	list = calloc(MAXINODE, sizeof(sfs_imgent_t));
+	inodes = malloc(MAXINODE * sizeof(int));
+	if (list == NULL || inodes == NULL) {
+		free(list);
+		free(inodes);
+		return -1;
+	}
+	
+	// the tree, each dir's entries together after it
+	list[0].type = 1;
+	inodes[0] = 0;
+	for (i = 0; i < numents; ++i) {
+		if (list[i].type != 1)
+			continue;
+		dir_open(&dir, inodes[i]);
+		while ((slot = dir_next(&dir, &entry)) != -1) {
+			if (slot < 2 || !strcmp(entry.name, ".")) // "." and "..", or removed by sfs_rm
+				continue;
+			if (numents == MAXINODE || entry.inode <= 0 || entry.inode >= MAXINODE
+					|| ((*maindisk).inode[entry.inode].status != 1 && (*maindisk).inode[entry.inode].status != 2))
+				break; // a loop in the tree or a bad entry, fsck's business
+			entry.name[16] = 0;
+			strcpy(list[numents].name, entry.name);
+			list[numents].parent = i;
+			list[numents].type = (*maindisk).inode[entry.inode].status;
+			if (list[numents].type == 2)
+				list[numents].size = (*maindisk).inode[entry.inode].size;
+			inodes[numents++] = entry.inode;
+		}
+		if (slot != -1 || dir.sector == -1) { // it stopped early, or a sector of it is corrupt
+			image_free(list, numents);
+			free(inodes);
+			return -1;
+		}
+	}
+	
+	// room for the data, and the sectors to read it from; clones may name a sector many times
+	for (i = 1, n = 0; i < numents; ++i) {
+		if (list[i].type == 2)
+			n += (list[i].size + SD_SECTORSIZE - 1) / SD_SECTORSIZE;
+	}
+	if ((req = malloc((n + 1) * sizeof(readreq_t))) == NULL) {
+		image_free(list, numents);
+		free(inodes);
+		return -1;
+	}
+	for (i = 1; i < numents; ++i) {
+		if (list[i].type != 2)
+			continue;
+		if ((list[i].data = calloc(list[i].size + 1, 1)) == NULL) {
+			image_free(list, numents);
+			free(inodes);
+			free(req);
+			return -1;
+		}
+		if ((*maindisk).inode[inodes[i]].numsector == 0) { // kept inside the inode
+			memcpy(list[i].data, (*maindisk).inode[inodes[i]].toblock, list[i].size);
+			continue;
+		}
+		tmpinode = inodes[i];
+		for (n = 0; n * SD_SECTORSIZE < list[i].size; ++n) {
+			if (n && n%7 == 0)
+				tmpinode = (*maindisk).inode[tmpinode].toinode;
+			if ((*maindisk).inode[tmpinode].toblock[n%7] == 0) // a hole, it stays zeros
+				continue;
+			req[numreq].sector = (*maindisk).inode[tmpinode].toblock[n%7];
+			req[numreq].ent = i;
+			req[numreq++].n = n;
+		}
+	}
+	
+	// one pass over the disk, a sector shared by clones is read once
+	qsort(req, numreq, sizeof(readreq_t), readreq_cmp);
+	for (i = 0; i < numreq; ++i) {
+		if (i == 0 || req[i].sector != req[i - 1].sector) {
+			while (SD_read(req[i].sector, data));
+			if (csum_check(req[i].sector, data)) {
+				image_free(list, numents);
+				free(inodes);
+				free(req);
+				return -1;
+			}
+		}
+		len = list[req[i].ent].size - req[i].n * SD_SECTORSIZE;
+		memcpy(list[req[i].ent].data + req[i].n * SD_SECTORSIZE, data, (len < SD_SECTORSIZE) ? len : SD_SECTORSIZE);
+	}
+	free(inodes);
+	free(req);
+	*ents = list;
+	return numents;
+} /* !sfs_readimage */
+
+void tables_init(){
+	int i;
+	
+	if(mainfptab == 0)
+	{
+		mainfptab = calloc(1, sizeof(fptab_t));
+	}
+	if(maindisk == 0){
+		maindisk = malloc(NUMMETA * SD_SECTORSIZE);
+		csumtab = (void*)maindisk + NUMHEADER * SD_SECTORSIZE;
+		snaptab = (void*)maindisk + SNAPSTART * SD_SECTORSIZE;
+	}
+	if(shadowdisk == 0){
+		shadowdisk = malloc(NUMMETA * SD_SECTORSIZE);
+	}
+	crc_init();
+	readonly = 0;
+	defragnext = 0;
+	if(maindirtab == 0)
+	{
+		maindirtab = malloc(MAXDIRTAB * sizeof(dircur_t));
+	}
+	cache_init();//	whatever it held belongs to the old filesystem
+	
+	for (i = 0; i < MAXFPTAB; ++i)
+	{
+		(*mainfptab).fptab[i] = 0;
+		(*mainfptab).pos[i] = 0;
+		(*mainfptab).ranext[i] = 0;
+		(*mainfptab).rawin[i] = 0;
+		(*mainfptab).raend[i] = 0;
+		free((*mainfptab).wbuf[i]);//	what was buffered belongs to the old filesystem
+		(*mainfptab).wbuf[i] = NULL;
+		(*mainfptab).wblen[i] = 0;
+	}
+	for (i = 0; i < MAXINODE; ++i)
+	{
+		wbowner[i] = -1;
+	}
+	for (i = 0; i < MAXDIRTAB; ++i)
+	{
+		maindirtab[i].inode = -1;
+	}
+}
+
+void header_sync(int sector){
+	void* data = (void*)maindisk + sector * SD_SECTORSIZE;
+	void* ondisk = shadowdisk + sector * SD_SECTORSIZE;
+	
+	if(memcmp(data, ondisk, SD_SECTORSIZE) == 0){
+		return;
+	}
+	while(SD_write(sector, data));
+	memcpy(ondisk, data, SD_SECTORSIZE);
+}
+
+void meta_sync(){
+	int i;
+	
+	if(readonly){//	maindisk holds a snapshot's inodes
+		return;
+	}
+	//	the header is written from its end, so the checksums and then the bitmap go first: a crash in between can leave a sector marked used that no inode has, never the other way around
+	meta_csum();
+	for(i = NUMMETA - 1; i >= 0; --i)
+	{
+		header_sync(i);
+	}
+}
+
+int journal_write(int sector, void* buf){
+	cache_t* entry;
+	
+	pthread_mutex_lock(&cachelock);
+	if(cachemap[sector] != -1 && memcmp(maincache[cachemap[sector]].data, buf, SD_SECTORSIZE) == 0){//	nothing changes, nothing to log
+		maincache[cachemap[sector]].used = 1;
+		pthread_mutex_unlock(&cachelock);
+		return 0;
+	}
+	entry = cache_get(sector, 0);
+	if(entry == NULL || (!(*entry).dirty && numjdirty == JMAXBLOCKS)){//	no room to hold it back, and writing it home now would break the group
+		pthread_mutex_unlock(&cachelock);
+		return -1;
+	}
+	memcpy((*entry).data, buf, SD_SECTORSIZE);
+	csumtab[sector] = csum_of(buf);
+	if(!(*entry).dirty){
+		(*entry).dirty = 1;
+		(*entry).pin++;
+		jdirty[numjdirty++] = sector;
+	}
+	pthread_mutex_unlock(&cachelock);
+	return 0;
+}
+
+int journal_end(){
+	numtrans++;
+	if(numtrans >= JGROUP){
+		return journal_commit();
+	}
+	return journal_room(JMAXBLOCKS / 2);//	so the next transaction finds half of the group free
+}
+
+int journal_room(int count){
+	if(readonly || journal_size() + count <= JMAXBLOCKS){
+		return 0;
+	}
+	return journal_commit();
+}
+
+int journal_size(){
+	int i, count = numjdirty;
+	
+	meta_csum();
+	for(i = 0; i < NUMMETA; ++i)
+	{
+		if(memcmp((void*)maindisk + i * SD_SECTORSIZE, shadowdisk + i * SD_SECTORSIZE, SD_SECTORSIZE)){
+			count++;
+		}
+	}
+	return count;
+}
+
+unsigned int journal_sum(void* data, unsigned int sum){
+	unsigned int* word = data;
+	int i;
+	
+	for(i = 0; i < SD_SECTORSIZE / sizeof(unsigned int); ++i)
+	{
+		sum = (sum << 1 | sum >> 31) ^ word[i];
+	}
+	return sum;
+}
+
+int journal_commit(){
+	char desc[SD_SECTORSIZE] = "";
+	char commit[SD_SECTORSIZE] = "";
+	char super[SD_SECTORSIZE] = "";
+	void* data[JMAXBLOCKS];
+	int home[JMAXBLOCKS];
+	int i, count = 0, head;
+	unsigned int sum = 0;
+	jdesc_t* jdesc = (void*)desc;
+	jcommit_t* jcommit = (void*)commit;
+	
+	if(readonly){//	maindisk holds a snapshot's inodes, and nothing changed
+		return 0;
+	}
+	meta_csum();
+	pthread_mutex_lock(&cachelock);
+	for(i = 0; i < numjdirty; ++i)
+	{
+		home[count] = jdirty[i];
+		data[count++] = maincache[cachemap[jdirty[i]]].data;
+	}
+	for(i = NUMMETA - 1; i >= 0 && count <= JMAXBLOCKS; --i)
+	{
+		if(memcmp((void*)maindisk + i * SD_SECTORSIZE, shadowdisk + i * SD_SECTORSIZE, SD_SECTORSIZE)){
+			if(count < JMAXBLOCKS){
+				home[count] = i;
+				data[count] = (void*)maindisk + i * SD_SECTORSIZE;
+			}
+			count++;
+		}
+	}
+	if(count == 0){
+		numtrans = 0;
+		pthread_mutex_unlock(&cachelock);
+		return 0;
+	}
+	if(count > JMAXBLOCKS){//	too much for one group; writing it home without the journal could be torn by a crash, so nothing is written
+		pthread_mutex_unlock(&cachelock);
+		return -1;
+	}
+	head = mainjsuper.head;
+	if(head + count + 2 > JSTART + JOURNALSIZE){//	wrap around, everything before is home already
+		head = JSTART + 1;
+	}
+	(*jdesc).magic = JMAGIC;
+	(*jdesc).seq = mainjsuper.seq + 1;
+	(*jdesc).count = count;
+	memcpy((*jdesc).home, home, count * sizeof(int));
+	while(SD_write(head, desc));
+	for(i = 0; i < count; ++i)
+	{
+		while(SD_write(head + 1 + i, data[i]));
+		sum = journal_sum(data[i], sum);
+	}
+	(*jcommit).magic = JMAGIC;
+	(*jcommit).seq = (*jdesc).seq;
+	(*jcommit).count = count;
+	(*jcommit).sum = sum;
+	while(SD_write(head + 1 + count, commit));
+	
+	//	the group is safe now, write it home
+	for(i = 0; i < count; ++i)
+	{
+		if(home[i] < NUMMETA){
+			header_sync(home[i]);
+		}
+		else{
+			while(SD_write(home[i], data[i]));
+		}
+	}
+	mainjsuper.seq++;
+	mainjsuper.head = head + count + 2;
+	memcpy(super, &mainjsuper, sizeof(jsuper_t));
+	while(SD_write(JSTART, super));
+	for(i = 0; i < numjdirty; ++i)
+	{
+		maincache[cachemap[jdirty[i]]].dirty = 0;
+		maincache[cachemap[jdirty[i]]].pin--;
+	}
+	numjdirty = 0;
+	numtrans = 0;
+	pthread_mutex_unlock(&cachelock);
+	return 0;
+}
+
+void journal_abort(){
+	cache_t* entry;
+	int i;
+	
+	if(readonly){
+		return;
+	}
+	pthread_mutex_lock(&cachelock);
+	for(i = 0; i < numjdirty; ++i)
+	{
+		entry = &maincache[cachemap[jdirty[i]]];
+		(*entry).dirty = 0;
+		(*entry).pin--;
+		(*entry).used = 0;
+		cachemap[jdirty[i]] = -1;//	the disk has it as it was
+		(*entry).sector = 0;
+	}
+	numjdirty = 0;
+	numtrans = 0;
+	memcpy(maindisk, shadowdisk, NUMMETA * SD_SECTORSIZE);
+	pthread_mutex_unlock(&cachelock);
+	//	a file or dir made in the group is gone with it, and so is whatever was open on it
+	for(i = 0; i < MAXFPTAB; ++i)
+	{
+		if((*mainfptab).fptab[i] != 0 && (*maindisk).inode[(*mainfptab).fptab[i]].status != 2){
+			if(wbowner[(*mainfptab).fptab[i]] == i){
+				wbowner[(*mainfptab).fptab[i]] = -1;
+			}
+			free((*mainfptab).wbuf[i]);
+			(*mainfptab).wbuf[i] = NULL;
+			(*mainfptab).wblen[i] = 0;
+			(*mainfptab).fptab[i] = 0;
+			(*mainfptab).pos[i] = 0;
+			(*mainfptab).ranext[i] = 0;
+			(*mainfptab).rawin[i] = 0;
+			(*mainfptab).raend[i] = 0;
+		}
+	}
+	for(i = 0; i < MAXDIRTAB; ++i)
+	{
+		if(maindirtab[i].inode != -1 && (*maindisk).inode[maindirtab[i].inode].status != 1){
+			maindirtab[i].inode = -1;
+		}
+	}
+	if((*maindisk).inode[cwd].status != 1){
+		cwd = 0;
+	}
+}
+
+void journal_replay(){
+	char super[SD_SECTORSIZE];
+	char desc[SD_SECTORSIZE];
+	char commit[SD_SECTORSIZE];
+	char data[SD_SECTORSIZE];
+	jdesc_t* jdesc = (void*)desc;
+	jcommit_t* jcommit = (void*)commit;
+	int i, try, head;
+	unsigned int sum;
+	
+	while(SD_read(JSTART, super));
+	memcpy(&mainjsuper, super, sizeof(jsuper_t));
+	if(mainjsuper.magic != JMAGIC){//	no journal on this disk
+		mainjsuper.magic = JMAGIC;
+		mainjsuper.seq = 0;
+		mainjsuper.head = JSTART + 1;
+		return;
+	}
+	//	groups are written home as soon as they are committed, so only the one after seq may be missing, either at head or wrapped around
+	for(try = 0; try < 2; ++try)
+	{
+		head = (try == 0)? mainjsuper.head : JSTART + 1;
+		if(head < JSTART + 1 || head + 2 > JSTART + JOURNALSIZE){
+			continue;
+		}
+		while(SD_read(head, desc));
+		if((*jdesc).magic != JMAGIC || (*jdesc).seq != mainjsuper.seq + 1 || (*jdesc).count <= 0
+				|| (*jdesc).count > JMAXBLOCKS || head + (*jdesc).count + 2 > JSTART + JOURNALSIZE){
+			continue;
+		}
+		while(SD_read(head + 1 + (*jdesc).count, commit));
+		if((*jcommit).magic != JMAGIC || (*jcommit).seq != (*jdesc).seq || (*jcommit).count != (*jdesc).count){
+			continue;
+		}
+		for(i = 0, sum = 0; i < (*jdesc).count; ++i)
+		{
+			while(SD_read(head + 1 + i, data));
+			sum = journal_sum(data, sum);
+		}
+		if(sum != (*jcommit).sum){
+			continue;
+		}
+		for(i = 0; i < (*jdesc).count; ++i)
+		{
+			while(SD_read(head + 1 + i, data));
+			while(SD_write((*jdesc).home[i], data));
+		}
+		mainjsuper.seq++;
+		mainjsuper.head = head + (*jdesc).count + 2;
+		memset(super, 0, SD_SECTORSIZE);
+		memcpy(super, &mainjsuper, sizeof(jsuper_t));
+		while(SD_write(JSTART, super));
+		return;
+	}
+}
+
+void crc_init(){
+	unsigned int crc;
+	int i, k;
+	
+	if(crc32c != NULL){
+		return;
+	}
+	for(i = 0; i < 256; ++i)
+	{
+		crc = i;
+		for(k = 0; k < 8; ++k)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ CRCPOLY : crc >> 1;
+		}
+		crctable[0][i] = crc;
+	}
+	for(i = 0; i < 256; ++i)//	crctable[k][i] is the byte i followed by k zero bytes
+	{
+		for(k = 1; k < 8; ++k)
+		{
+			crctable[k][i] = crctable[0][crctable[k - 1][i] & 0xff] ^ (crctable[k - 1][i] >> 8);
+		}
+	}
+	for(k = 0; k < 4; ++k)//	the CRC is linear, so a register is shifted one byte of it at a time
+	{
+		for(i = 0; i < 256; ++i)
+		{
+			crcshift[k][i] = crc32c_sw((unsigned int)i << (8 * k), (const unsigned char*)zerosector, CRCSTRIDE);
+		}
+	}
+	crc32c = crc32c_sw;
+#if defined(__x86_64__)
+	if(__builtin_cpu_supports("sse4.2")){
+		crc32c = crc32c_hw;
+	}
+#endif
+}
+
+unsigned int crc32c_sw(unsigned int crc, const unsigned char* data, int len){
+	unsigned int lo, hi;
+	
+	for(; len > 0 && ((unsigned long)data & 7) != 0; --len)
+	{
+		crc = crctable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	}
+	for(; len >= 8; len -= 8, data += 8)//	little endian, like the rest of the image
+	{
+		lo = crc ^ *(unsigned int*)data;
+		hi = *(unsigned int*)(data + 4);
+		crc = crctable[7][lo & 0xff] ^ crctable[6][(lo >> 8) & 0xff] ^ crctable[5][(lo >> 16) & 0xff] ^ crctable[4][lo >> 24]
+			^ crctable[3][hi & 0xff] ^ crctable[2][(hi >> 8) & 0xff] ^ crctable[1][(hi >> 16) & 0xff] ^ crctable[0][hi >> 24];
+	}
+	for(; len > 0; --len)
+	{
+		crc = crctable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+unsigned int crc32c_hw(unsigned int crc, const unsigned char* data, int len){
+	unsigned long long a, b, c;
+	int i;
+	
+	for(; len > 0 && ((unsigned long)data & 7) != 0; --len)
+	{
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	//	one crc32 instruction waits for the one before it, so three streams run side by side and are joined after
+	for(; len >= 3 * CRCSTRIDE; len -= 3 * CRCSTRIDE, data += 3 * CRCSTRIDE)
+	{
+		a = crc;
+		b = 0;
+		c = 0;
+		for(i = 0; i < CRCSTRIDE; i += 8)
+		{
+			a = _mm_crc32_u64(a, *(unsigned long long*)(data + i));
+			b = _mm_crc32_u64(b, *(unsigned long long*)(data + CRCSTRIDE + i));
+			c = _mm_crc32_u64(c, *(unsigned long long*)(data + 2 * CRCSTRIDE + i));
+		}
+		crc = crc_shift(crc_shift(a) ^ b) ^ c;
+	}
+	for(; len >= 8; len -= 8, data += 8)
+	{
+		crc = _mm_crc32_u64(crc, *(unsigned long long*)data);
+	}
+	for(; len > 0; --len)
+	{
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	return crc;
+}
+#else
+unsigned int crc32c_hw(unsigned int crc, const unsigned char* data, int len){
+	return crc32c_sw(crc, data, len);
+}
+#endif
+
+unsigned int crc_shift(unsigned int crc){
+	return crcshift[0][crc & 0xff] ^ crcshift[1][(crc >> 8) & 0xff] ^ crcshift[2][(crc >> 16) & 0xff] ^ crcshift[3][crc >> 24];
+}
+
+unsigned int csum_of(void* data){
+	unsigned int crc = ~crc32c(~0u, data, SD_SECTORSIZE);
+	
+	return (crc == 0) ? ~0u : crc;
+}
+
+int csum_check(int sector, void* data){
+	if(csumtab[sector] == 0 || csumtab[sector] == csum_of(data)){
+		return 0;
+	}
+	return -1;
+}
+
+void meta_csum(){
+	unsigned int* ondisk = (void*)shadowdisk + NUMHEADER * SD_SECTORSIZE;
+	int i;
+	
+	for(i = 0; i < NUMMETA; ++i)
+	{
+		if(i == NUMHEADER){//	the checksum table has none of its own
+			i = SNAPSTART;
+		}
+		if(memcmp((void*)maindisk + i * SD_SECTORSIZE, shadowdisk + i * SD_SECTORSIZE, SD_SECTORSIZE)){
+			csumtab[i] = csum_of((void*)maindisk + i * SD_SECTORSIZE);
+		}
+		else{//	changed back since an earlier call, before it was written
+			csumtab[i] = ondisk[i];
+		}
+	}
+}
+
+void* fsck_run(void* arg){
+	fsck_t* ck = arg;
+	int first, i;
+	
+	while((first = __sync_fetch_and_add(&(*ck).next, FSCKRANGE)) < MAXINODE){
+		for(i = first; i < first + FSCKRANGE && i < MAXINODE; ++i)
+		{
+			if((*maindisk).inode[i].status != 1 && (*maindisk).inode[i].status != 2){
+				continue;
+			}
+			if((*ck).phase == 0){
+				fsck_inode(ck, i);
+			}
+			else if((*maindisk).inode[i].status == 1 && (*ck).flags[i] == 0){//	only a dir whose sectors are sane can be read
+				fsck_dir(ck, i);
+			}
+		}
+	}
+	return NULL;
+}
+
+int fsck_min(int* p, int v){
+	int old;
+	
+	do{
+		old = *p;
+	}while((old == -1 || v < old) && !__sync_bool_compare_and_swap(p, old, v));
+	return old;
+}
+
+int fsck_max(int* p, int v){
+	int old;
+	
+	do{
+		old = *p;
+	}while(v > old && !__sync_bool_compare_and_swap(p, old, v));
+	return old;
+}
+
+void fsck_inode(fsck_t* ck, int inode){
+	inode_t* node = &(*maindisk).inode[inode];
+	int datastart = JSTART + JOURNALSIZE;
+	int n, next, old, sector, tmpinode = inode;
+	char data[SD_SECTORSIZE];
+	
+	if((*node).numsector < 0 || (*node).size < 0 || ((*node).status == 1 && (*node).numsector == 0)
+			|| ((*node).numsector == 0 && (*node).size > INLINESIZE)
+			|| ((*node).numsector > 0 && (*node).size > (*node).numsector * SD_SECTORSIZE)){
+		__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADSIZE);
+	}
+	if((*node).numsector <= 0){//	the data is inside the inode, there is no chain
+		if((*node).toinode != -1){
+			__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADCHAIN);
+		}
+		return;
+	}
+	for(n = 0; n < (*node).numsector; ++n)
+	{
+		if(n && n%7 == 0){
+			next = (*maindisk).inode[tmpinode].toinode;
+			if(next <= 0 || next >= MAXINODE || (*maindisk).inode[next].status != 3){//	missing or not a chain inode
+				__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADCHAIN);
+				return;
+			}
+			if((old = fsck_min(&(*ck).chainof[next], inode)) != -1){//	in two chains, or twice in this one: whoever comes second flags both, so all of them end up flagged
+				__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADCHAIN);
+				__sync_fetch_and_or(&(*ck).flags[old], FSCK_BADCHAIN);
+			}
+			tmpinode = next;
+		}
+		if((sector = (*maindisk).inode[tmpinode].toblock[n%7]) == 0){//	a hole, dirs have none
+			if((*node).status == 1){
+				__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADSECTOR);
+			}
+			continue;
+		}
+		if(sector < datastart || sector >= SD_NUMSECTORS){
+			__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADSECTOR);
+			continue;
+		}
+		__sync_fetch_and_add(&(*ck).uses[sector], 1);
+		fsck_min(&(*ck).owner[sector], inode);
+		fsck_max(&(*ck).other[sector], inode);
+		if(csumtab[sector] != 0 && sector_read(sector, data)){//	every inode using a bad sector is told, not just the first to get there
+			(*ck).badcsum[sector] = 1;
+			__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADCSUM);
+		}
+	}
+	if((*maindisk).inode[tmpinode].toinode != -1){//	the chain goes on pass numsector
+		__sync_fetch_and_or(&(*ck).flags[inode], FSCK_BADCHAIN);
+	}
+}
+
+void fsck_dir(fsck_t* ck, int inode){
+	dircur_t dir;
+	file_t entry;
+	int slot;
+	
+	dir_open(&dir, inode);
+	while((slot = dir_next(&dir, &entry)) != -1){
+		entry.name[16] = 0;
+		if(slot == 0){
+			if(strcmp(entry.name, ".") || entry.inode != inode){
+				(*ck).flags[inode] |= FSCK_BADDOT;
+			}
+			continue;
+		}
+		if(slot == 1){
+			if(strcmp(entry.name, "..") || entry.inode < 0 || entry.inode >= MAXINODE){
+				(*ck).flags[inode] |= FSCK_BADDOT;
+			}
+			else{
+				(*ck).dotdot[inode] = entry.inode;
+			}
+			continue;
+		}
+		if(!strcmp(entry.name, ".")){//	removed by sfs_rm
+			continue;
+		}
+		if(entry.inode <= 0 || entry.inode >= MAXINODE
+				|| ((*maindisk).inode[entry.inode].status != 1 && (*maindisk).inode[entry.inode].status != 2)){
+			(*ck).flags[inode] |= FSCK_BADENTRY;
+			continue;
+		}
+		__sync_fetch_and_add(&(*ck).links[entry.inode], 1);
+		fsck_min(&(*ck).parent[entry.inode], inode);
+	}
+}
+
+void fillbitmap(int sector){
+	unsigned char* bitmap=(*maindisk).bitmap;
+	bitmap[sector/8] |= (1<<(sector%8));
+}
+
+void emptybitmap(int sector){
+	unsigned char* bitmap=(*maindisk).bitmap;
+	if((*snaptab).share[sector]){//	another file still has it
+		(*snaptab).share[sector]--;
+		return;
+	}
+	if((*snaptab).refcnt[sector]){//	a snapshot still has it
+		return;
+	}
+	bitmap[sector/8] &= (~(1<<(sector%8)));
+	csumtab[sector] = 0;//	whatever it holds now is nobody's, the next owner may read it before writing all of it
+}
+
+void init_inode(inode_t* inode){
+	(*inode).status = 0;
+	(*inode).numsector = 0;
+	(*inode).size = 0;
+	int i;
+	for(i = 0; i < 7; ++i)
+	{
+		(*inode).toblock[i] = 0;
+	}
+	(*inode).toinode = -1;
+}
+
+void init_dir(inode_t* thisdirinode, inode_t* upperdirinode){// to be done
+	file_t* thisdir;
+	file_t* upperdir;
+	
+	//	this doesn't work
+	thisdir = (void*)maindisk + (*thisdirinode).toblock[0] * SD_SECTORSIZE;
+	upperdir = (void*)maindisk + (*thisdirinode).toblock[0] * SD_SECTORSIZE + sizeof(file_t);
+	
+}
+
+int findanemptysector(int goal){
+	int ret, end, pass, again;
+	unsigned char* bitmap=(*maindisk).bitmap;
+	unsigned char* ondisk=(*(disk_t*)shadowdisk).bitmap;//	a sector freed since the last commit is still used there, and is not written until the group freeing it is home
+	
+	if(goal < 1 || goal >= SD_NUMSECTORS){
+		goal = 1;
+	}
+	for(again = 0; again < 2; ++again)//	a second time once the sectors freed in the running group are committed
+	{
+		for(pass = 0; pass < 2; ++pass)//	from goal to the end, then from the start to goal
+		{
+			end = (pass == 0)? SD_NUMSECTORS : goal;
+			for(ret = (pass == 0)? goal : 1; ret < end; ++ret)
+			{
+				if(!((bitmap[ret/8] | ondisk[ret/8]) & (1<<(ret%8)))){
+					return ret;
+				}
+			}
+		}
+		if(!bitmap_deferred() || journal_commit()){
+			break;
+		}
+	}
+	
+	//puts("findanemptysector: no sector available.");
+	return -1;
+}
+
+int bitmap_deferred(){
+	unsigned char* bitmap=(*maindisk).bitmap;
+	unsigned char* ondisk=(*(disk_t*)shadowdisk).bitmap;
+	int i;
+	
+	for(i = 0; i < SD_NUMSECTORS/8; ++i)
+	{
+		if(ondisk[i] & ~bitmap[i]){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int findanemptyrun(int goal, int count, int* found){
+	int ret, len, end, pass, again;
+	int best = -1, bestlen = 0;
+	unsigned char* bitmap=(*maindisk).bitmap;
+	unsigned char* ondisk=(*(disk_t*)shadowdisk).bitmap;//	as in findanemptysector
+	
+	if(goal < 1 || goal >= SD_NUMSECTORS){
+		goal = 1;
+	}
+	for(again = 0; again < 2; ++again)//	as in findanemptysector
+	{
+		for(pass = 0; pass < 2; ++pass)//	from goal to the end, then from the start to goal
+		{
+			end = (pass == 0)? SD_NUMSECTORS : goal;
+			ret = (pass == 0)? goal : 1;
+			while(ret < end)
+			{
+				if(ret%8 == 0 && (bitmap[ret/8] | ondisk[ret/8]) == 0xff){//	skip a full byte at once
+					ret += 8;
+					continue;
+				}
+				if((bitmap[ret/8] | ondisk[ret/8]) & (1<<(ret%8))){
+					ret++;
+					continue;
+				}
+				for(len = 0; len < count && ret + len < SD_NUMSECTORS && !((bitmap[(ret+len)/8] | ondisk[(ret+len)/8]) & (1<<((ret+len)%8))); ++len);
+				if(len == count){
+					*found = len;
+					return ret;
+				}
+				if(len > bestlen){
+					best = ret;
+					bestlen = len;
+				}
+				ret += len;
+			}
+		}
+		if(best != -1 || !bitmap_deferred() || journal_commit()){
+			break;
+		}
+	}
+	*found = bestlen;
+	return best;
+}
+
+int findanemptyinode(int group){
+	int ret, i;
+	
+	if(group < 0 || group >= NUMGROUP){
+		group = 0;
+	}
+	for(i = 0; i < MAXINODE; ++i)
+	{
+		ret = (group * GROUPINODES + i) % MAXINODE;
+		if((*maindisk).inode[ret].status == 0){
+			return ret;
+		}
+	}
+	
+	//puts("findanemptyinode: no inode available!");
+	return -1;
+}
+
+int		group_of(int inode){
+	int group = inode / GROUPINODES;
+	return (group < NUMGROUP)? group : NUMGROUP - 1;
+}
+
+int		group_pick(){
+	unsigned char* bitmap=(*maindisk).bitmap;
+	int group, i, numfree, best = 0, bestfree = -1;
+	
+	for(group = 0; group < NUMGROUP; ++group)
+	{
+		for(i = group * GROUPINODES; i < (group + 1) * GROUPINODES && (*maindisk).inode[i].status != 0; ++i);
+		if(i == (group + 1) * GROUPINODES){//	no inode left for the dir
+			continue;
+		}
+		numfree = 0;
+		for(i = group * GROUPSECTORS; i < (group + 1) * GROUPSECTORS; ++i)
+		{
+			if(!(bitmap[i/8] & (1<<(i%8)))){
+				numfree++;
+			}
+		}
+		if(numfree > bestfree){
+			best = group;
+			bestfree = numfree;
+		}
+	}
+	return best;
+}
+
+int		inode_goal(int inode){
+	int tmpinode = inode;
+	int i, goal = group_of(inode) * GROUPSECTORS;
+	
+	for(i = 0; i < (*maindisk).inode[inode].numsector; ++i)
+	{
+		if(i && i%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		if((*maindisk).inode[tmpinode].toblock[i%7] != 0){
+			goal = (*maindisk).inode[tmpinode].toblock[i%7] + 1;
+		}
+	}
+	return goal;
+}
+
+void*	inode_read(int inode){
+	void* ret = malloc((*maindisk).inode[inode].numsector * SD_SECTORSIZE);
+	
+	int tmpinode = inode;
+	int i;
+	for(i = 0; i < (*maindisk).inode[inode].numsector; ++i)
+	{
+		if(i && i%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		if((*maindisk).inode[tmpinode].toblock[i%7] == 0){//	a hole
+			memset(ret + i * SD_SECTORSIZE, 0, SD_SECTORSIZE);
+			continue;
+		}
+		if(sector_read((*maindisk).inode[tmpinode].toblock[i%7], ret + i * SD_SECTORSIZE)){
+			free(ret);
+			return NULL;
+		}
+	}
+	return ret;
+}
+
+int		inode_append(int inode){
+	int n = (*maindisk).inode[inode].numsector;
+	int tmpinode = inode;
+	int sector, next;
+	
+	if(-1 == (sector = findanemptysector(inode_goal(inode)))){
+		return -1;
+	}
+	while(n >= 7){
+		if((*maindisk).inode[tmpinode].toinode == -1){//	the chain is full, link one more inode
+			if(-1 == (next = findanemptyinode(group_of(inode)))){
+				return -1;
+			}
+			(*maindisk).inode[next].status = 3;
+			(*maindisk).inode[tmpinode].toinode = next;
+		}
+		tmpinode = (*maindisk).inode[tmpinode].toinode;
+		n -= 7;
+	}
+	(*maindisk).inode[tmpinode].toblock[n] = sector;
+	fillbitmap(sector);
+	(*maindisk).inode[inode].numsector++;
+	return 0;
+}
+
+int		inode_uninline(int inode){
+	char data[SD_SECTORSIZE] = "";
+	
+	memcpy(data, (*maindisk).inode[inode].toblock, INLINESIZE);
+	memset((*maindisk).inode[inode].toblock, 0, INLINESIZE);
+	if(inode_append(inode)){
+		memcpy((*maindisk).inode[inode].toblock, data, INLINESIZE);
+		return -1;
+	}
+	sector_write((*maindisk).inode[inode].toblock[0], (void*)data);
+	return 0;
+}
+
+int		inode_write(int inode, void* data){
+	int tmpinode = inode;
+	int i, sector;
+	for(i = 0; i < (*maindisk).inode[inode].numsector; ++i)
+	{
+		if(i && i%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		if((*maindisk).inode[tmpinode].toblock[i%7] == 0){//	a hole, only dirs come here and they have none
+			continue;
+		}
+		if((sector = sector_cow(&(*maindisk).inode[tmpinode].toblock[i%7])) == -1){
+			return -1;
+		}
+		if(journal_write(sector, (void*)data + i * SD_SECTORSIZE)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void	inode_erase(int inode){
+	int tmpinode = inode;
+	int preinode;
+	int i;
+	for(i = 0; i < (*maindisk).inode[inode].numsector; ++i)
+	{
+		if(i && i%7 == 0){
+			preinode = tmpinode;
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+			if(preinode != inode){
+				init_inode(&((*maindisk).inode[preinode]));
+			}
+		}
+		if((*maindisk).inode[tmpinode].toblock[i%7] != 0){
+			emptybitmap((*maindisk).inode[tmpinode].toblock[i%7]);
+		}
+	}
+	while(tmpinode != -1){//	the rest of the chain, the head goes last since it holds numsector
+		preinode = tmpinode;
+		tmpinode = (*maindisk).inode[tmpinode].toinode;
+		if(preinode != inode){
+			init_inode(&((*maindisk).inode[preinode]));
+		}
+	}
+	init_inode(&((*maindisk).inode[inode]));
+}
+
+int		inode_getsector(int inode, int n){
+	int tmpinode = inode_walk(inode, n);
+	if(tmpinode == -1){
+		return 0;
+	}
+	return (*maindisk).inode[tmpinode].toblock[n%7];
+}
+
+int		inode_walk(int inode, int n){
+	int tmpinode = inode;
+	while(n >= 7 && tmpinode != -1){
+		tmpinode = (*maindisk).inode[tmpinode].toinode;
+		n -= 7;
+	}
+	return tmpinode;
+}
+
+int		file_truncate(int inode, int length){
+	int size = (*maindisk).inode[inode].size;
+	int change = (length + SD_SECTORSIZE - 1) / SD_SECTORSIZE - (*maindisk).inode[inode].numsector;
+	
+	if(journal_room(JCHANGE((change < 0)? -change : change))){
+		return -1;
+	}
+	if((*maindisk).inode[inode].numsector == 0){//	the data is kept inside the inode
+		if(length <= INLINESIZE){
+			if(length > size){
+				memset((void*)(*maindisk).inode[inode].toblock + size, 0, length - size);
+			}
+			(*maindisk).inode[inode].size = length;
+			return 0;
+		}
+		if(size > 0){
+			if(inode_uninline(inode)){
+				return -1;
+			}
+		}
+		else{
+			memset((*maindisk).inode[inode].toblock, 0, INLINESIZE);
+		}
+	}
+	if(length < size){
+		inode_truncate(inode, (length + SD_SECTORSIZE - 1) / SD_SECTORSIZE);
+	}
+	else if(length > size){//	the new bytes are a hole, except what is left in sectors we already have
+		if(file_zero(inode, size, length)){
+			return -1;
+		}
+		if(inode_extend(inode, (length + SD_SECTORSIZE - 1) / SD_SECTORSIZE)){
+			return -1;
+		}
+	}
+	(*maindisk).inode[inode].size = length;
+	return 0;
+}
+
+void	inode_truncate(int inode, int numsector){
+	int lastkeep = inode_walk(inode, (numsector > 0)? numsector - 1 : 0);
+	int tmpinode = inode;
+	int n = 0;
+	int j, next;
+	
+	if(numsector >= (*maindisk).inode[inode].numsector){
+		return;
+	}
+	while(tmpinode != -1){
+		for(j = 0; j < 7; ++j)
+		{
+			if(n + j >= numsector && (*maindisk).inode[tmpinode].toblock[j] != 0){
+				emptybitmap((*maindisk).inode[tmpinode].toblock[j]);
+				(*maindisk).inode[tmpinode].toblock[j] = 0;
+			}
+		}
+		next = (*maindisk).inode[tmpinode].toinode;
+		if(n > 0 && n >= numsector){//	nothing is left in this inode of the chain
+			init_inode(&((*maindisk).inode[tmpinode]));
+		}
+		tmpinode = next;
+		n += 7;
+	}
+	(*maindisk).inode[lastkeep].toinode = -1;
+	(*maindisk).inode[inode].numsector = numsector;
+}
+
+int		inode_extend(int inode, int numsector){
+	int tmpinode = inode;
+	int n, next;
+	
+	for(n = 7; n < numsector; n += 7)
+	{
+		if((*maindisk).inode[tmpinode].toinode == -1){//	the chain is full, link one more inode
+			if(-1 == (next = findanemptyinode(group_of(inode)))){
+				return -1;
+			}
+			(*maindisk).inode[next].status = 3;
+			(*maindisk).inode[tmpinode].toinode = next;
+		}
+		tmpinode = (*maindisk).inode[tmpinode].toinode;
+	}
+	if(numsector > (*maindisk).inode[inode].numsector){
+		(*maindisk).inode[inode].numsector = numsector;
+	}
+	return 0;
+}
+
+int		file_read(int inode, char* buffer, int pos, int length){
+	sfs_iovec_t iov;
+	
+	iov.base = buffer;
+	iov.len = length;
+	return file_readv(inode, &iov, 1, pos, length);
+}
+
+int		file_write(int inode, char* buffer, int pos, int length){
+	sfs_iovec_t iov;
+	
+	iov.base = buffer;
+	iov.len = length;
+	return file_writev(inode, &iov, 1, pos);
+}
+
+int		file_readv(int inode, sfs_iovec_t* iov, int iovcnt, int pos, int length){
+	char data[SD_SECTORSIZE];
+	int n, off, len, sector;
+	int tmpinode;
+	iovcur_t cur;
+	char* whole;
+	
+	iov_start(&cur, iov, iovcnt);
+	if((*maindisk).inode[inode].numsector == 0){//	the data is kept inside the inode
+		iov_scatter(&cur, (void*)(*maindisk).inode[inode].toblock + pos, length);
+		return 0;
+	}
+	n = pos / SD_SECTORSIZE;
+	off = pos % SD_SECTORSIZE;
+	tmpinode = inode_walk(inode, n);
+	while(length > 0){
+		len = (SD_SECTORSIZE - off < length)? SD_SECTORSIZE - off : length;
+		sector = (n < (*maindisk).inode[inode].numsector)? (*maindisk).inode[tmpinode].toblock[n%7] : 0;
+		if(sector == 0){//	a hole, no need to touch the disk
+			memset(data, 0, len);
+			iov_scatter(&cur, data, len);
+		}
+		else if(len == SD_SECTORSIZE && (whole = iov_contig(&cur, len)) != NULL){//	a whole sector goes right into the buffer
+			if(sector_read(sector, whole)){
+				return -1;
+			}
+		}
+		else{
+			if(sector_read(sector, data)){
+				return -1;
+			}
+			iov_scatter(&cur, data + off, len);
+		}
+		length -= len;
+		off = 0;
+		n++;
+		if(n%7 == 0 && length > 0 && n < (*maindisk).inode[inode].numsector){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+	}
+	return 0;
+}
+
+int		file_writev(int inode, sfs_iovec_t* iov, int iovcnt, int pos){
+	char data[SD_SECTORSIZE];
+	int n, off, len, sector, last, i, tmp;
+	int numhole = 0, run = 0, next = 0, first;
+	int tmpinode;
+	int size = (*maindisk).inode[inode].size;
+	int length = iov_length(iov, iovcnt);
+	iovcur_t cur;
+	char* whole;
+	
+	first = (pos / SD_SECTORSIZE < (*maindisk).inode[inode].numsector)? pos / SD_SECTORSIZE : (*maindisk).inode[inode].numsector;
+	if(journal_room(JCHANGE((pos + length + SD_SECTORSIZE - 1) / SD_SECTORSIZE - first))){//	the sectors it writes, and the holes it maps before them
+		return -1;
+	}
+	if(file_invalidate(inode, (pos < size)? pos : size, pos + length)){//	with the zeros between the old end and pos
+		return -1;
+	}
+	iov_start(&cur, iov, iovcnt);
+	if((*maindisk).inode[inode].numsector == 0){
+		if(pos + length <= INLINESIZE){//	still small enough to stay inside the inode
+			if(pos > size){
+				memset((void*)(*maindisk).inode[inode].toblock + size, 0, pos - size);
+			}
+			iov_gather(&cur, (void*)(*maindisk).inode[inode].toblock + pos, length);
+			(*maindisk).inode[inode].size = (pos + length > size)? pos + length : size;
+			return 0;
+		}
+		if(size > 0){//	it grows out of the inode, give its data a real sector first
+			if(inode_uninline(inode)){
+				return -1;
+			}
+		}
+		else{
+			memset((*maindisk).inode[inode].toblock, 0, INLINESIZE);
+		}
+	}
+	if(pos > size){//	the bytes between the old end and pos must read as zeros
+		if(file_zero(inode, size, pos)){
+			return -1;
+		}
+	}
+	if(inode_extend(inode, (pos + length + SD_SECTORSIZE - 1) / SD_SECTORSIZE)){
+		return -1;
+	}
+	
+	n = pos / SD_SECTORSIZE;
+	off = pos % SD_SECTORSIZE;
+	tmpinode = inode_walk(inode, n);
+	//	count the holes first, so the sectors for all of them can be asked for as one run
+	last = (pos + length - 1) / SD_SECTORSIZE;
+	for(i = n, tmp = tmpinode; i <= last; ++i){
+		if(i != n && i%7 == 0){
+			tmp = (*maindisk).inode[tmp].toinode;
+		}
+		if((*maindisk).inode[tmp].toblock[i%7] == 0){
+			numhole++;
+		}
+	}
+	while(length > 0){
+		len = (SD_SECTORSIZE - off < length)? SD_SECTORSIZE - off : length;
+		sector = (*maindisk).inode[tmpinode].toblock[n%7];
+		if(sector == 0){//	fill the hole with a new sector
+			if(run == 0 && -1 == (next = findanemptyrun(inode_goal(inode), numhole, &run))){
+				return -1;
+			}
+			sector = next++;
+			run--;
+			numhole--;
+			fillbitmap(sector);
+			(*maindisk).inode[tmpinode].toblock[n%7] = sector;
+			if(len != SD_SECTORSIZE){
+				memset(data, 0, SD_SECTORSIZE);
+			}
+		}
+		else if(len != SD_SECTORSIZE){//	only part of the sector changes, read it first
+			if(sector_read(sector, data)){
+				return -1;
+			}
+		}
+		if((sector = sector_cow(&(*maindisk).inode[tmpinode].toblock[n%7])) == -1){
+			return -1;
+		}
+		if(len == SD_SECTORSIZE && (whole = iov_contig(&cur, len)) != NULL){//	a whole sector comes right from the buffer
+			sector_write(sector, whole);
+		}
+		else{
+			iov_gather(&cur, data + off, len);
+			sector_write(sector, data);
+		}
+		pos += len;
+		length -= len;
+		off = 0;
+		n++;
+		if(pos > (*maindisk).inode[inode].size){
+			(*maindisk).inode[inode].size = pos;
+		}
+		if(n%7 == 0 && length > 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+	}
+	return 0;
+}
+
+int		iov_length(sfs_iovec_t* iov, int iovcnt){
+	int i, length = 0;
+	for(i = 0; i < iovcnt; ++i)
+	{
+		if(iov[i].len < 0 || iov[i].len > 0x7fffffff - length){
+			return -1;
+		}
+		length += iov[i].len;
+	}
+	return length;
+}
+
+void	iov_start(iovcur_t* cur, sfs_iovec_t* iov, int iovcnt){
+	(*cur).iov = iov;
+	(*cur).iovcnt = iovcnt;
+	(*cur).idx = 0;
+	(*cur).off = 0;
+}
+
+char*	iov_contig(iovcur_t* cur, int len){
+	char* ret;
+	
+	while((*cur).idx < (*cur).iovcnt && (*cur).off == (*cur).iov[(*cur).idx].len){//	skip the used up or empty ones
+		(*cur).idx++;
+		(*cur).off = 0;
+	}
+	if((*cur).idx == (*cur).iovcnt || (*cur).iov[(*cur).idx].len - (*cur).off < len){
+		return NULL;
+	}
+	ret = (*cur).iov[(*cur).idx].base + (*cur).off;
+	(*cur).off += len;
+	return ret;
+}
+
+void	iov_gather(iovcur_t* cur, char* dst, int len){
+	int n;
+	
+	while(len > 0 && (*cur).idx < (*cur).iovcnt){
+		n = (*cur).iov[(*cur).idx].len - (*cur).off;
+		if(n > len){
+			n = len;
+		}
+		memcpy(dst, (*cur).iov[(*cur).idx].base + (*cur).off, n);
+		dst += n;
+		len -= n;
+		(*cur).off += n;
+		if((*cur).off == (*cur).iov[(*cur).idx].len){
+			(*cur).idx++;
+			(*cur).off = 0;
+		}
+	}
+}
+
+void	iov_scatter(iovcur_t* cur, char* src, int len){
+	int n;
+	
+	while(len > 0 && (*cur).idx < (*cur).iovcnt){
+		n = (*cur).iov[(*cur).idx].len - (*cur).off;
+		if(n > len){
+			n = len;
+		}
+		memcpy((*cur).iov[(*cur).idx].base + (*cur).off, src, n);
+		src += n;
+		len -= n;
+		(*cur).off += n;
+		if((*cur).off == (*cur).iov[(*cur).idx].len){
+			(*cur).idx++;
+			(*cur).off = 0;
+		}
+	}
+}
+
+int		file_zero(int inode, int from, int to){
+	char data[SD_SECTORSIZE];
+	int n, off, len, sector;
+	int numsector = (*maindisk).inode[inode].numsector;
+	
+	if(to > numsector * SD_SECTORSIZE){//	there is nothing but holes after the mapping
+		to = numsector * SD_SECTORSIZE;
+	}
+	if(file_invalidate(inode, from, to)){
+		return -1;
+	}
+	for(; from < to; from += len)
+	{
+		n = from / SD_SECTORSIZE;
+		off = from % SD_SECTORSIZE;
+		len = (SD_SECTORSIZE - off < to - from)? SD_SECTORSIZE - off : to - from;
+		if((sector = inode_getsector(inode, n)) == 0){
+			continue;
+		}
+		if(len == SD_SECTORSIZE){
+			memset(data, 0, SD_SECTORSIZE);
+		}
+		else{
+			if(sector_read(sector, data)){
+				return -1;
+			}
+			memset(data + off, 0, len);
+		}
+		if((sector = sector_cow(&(*maindisk).inode[inode_walk(inode, n)].toblock[n%7])) == -1){
+			return -1;
+		}
+		sector_write(sector, data);
+	}
+	return 0;
+}
+
+int		file_invalidate(int inode, int from, int to){
+	unsigned int* ondisk = (void*)shadowdisk + NUMHEADER * SD_SECTORSIZE;//	the checksum table as the disk has it
+	int numsector = (*maindisk).inode[inode].numsector;
+	int n, last, sector, tmpinode;
+	int count = 0;
+	
+	if(from >= to || from >= numsector * SD_SECTORSIZE){
+		return 0;
+	}
+	n = from / SD_SECTORSIZE;
+	last = (to - 1) / SD_SECTORSIZE;
+	if(last >= numsector){
+		last = numsector - 1;
+	}
+	for(tmpinode = inode_walk(inode, n); n <= last; ++n)
+	{
+		if(n != from / SD_SECTORSIZE && n%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		sector = (*maindisk).inode[tmpinode].toblock[n%7];
+		//	a shared sector is copied to a new one by sector_cow and keeps its checksum
+		if(sector != 0 && !(*snaptab).refcnt[sector] && !(*snaptab).share[sector] && ondisk[sector] != 0){
+			csumtab[sector] = 0;
+			count++;
+		}
+	}
+	if(count == 0){//	the disk knows nothing of them yet, or they were cleared since the last commit
+		return 0;
+	}
+	return journal_commit();
+}
+
+void	dir_open(dircur_t* dir, int inode){
+	(*dir).inode = inode;
+	(*dir).pos = 0;
+	(*dir).sector = -1;
+}
+
+int		dir_next(dircur_t* dir, file_t* entry){
+	int off = (*dir).pos * sizeof(file_t);
+	int len;
+	
+	//	the same bound as tmpend, the last file
+	if(off >= (*maindisk).inode[(*dir).inode].numsector * SD_SECTORSIZE - sizeof(file_t)){
+		return -1;
+	}
+	if((*dir).sector != off / SD_SECTORSIZE){
+		(*dir).sector = off / SD_SECTORSIZE;
+		if(sector_read(inode_getsector((*dir).inode, (*dir).sector), (*dir).buf)){//	a corrupt sector ends the dir
+			(*dir).sector = -1;
+			return -1;
+		}
+	}
+	len = SD_SECTORSIZE - off % SD_SECTORSIZE;
+	if(len >= sizeof(file_t)){
+		memcpy(entry, (*dir).buf + off % SD_SECTORSIZE, sizeof(file_t));
+	}
+	else{//	the file_t lays across two sectors
+		memcpy(entry, (*dir).buf + off % SD_SECTORSIZE, len);
+		(*dir).sector++;
+		if(sector_read(inode_getsector((*dir).inode, (*dir).sector), (*dir).buf)){
+			(*dir).sector = -1;
+			return -1;
+		}
+		memcpy((void*)entry + len, (*dir).buf, sizeof(file_t) - len);
+	}
+	if((*entry).name[0] == 0){
+		return -1;
+	}
+	return (*dir).pos++;
 }
 
-void emptybitmap(int sector){
-	unsigned char* bitmap=(*maindisk).bitmap;
-	bitmap[sector/8] &= (~(1<<(sector%8)));
+int		dir_lookup(int dirinode, char* name){
+	dircur_t dir;
+	file_t tmpfile;
+	
+	dir_open(&dir, dirinode);
+	while(dir_next(&dir, &tmpfile) != -1){
+		if(!strncmp(tmpfile.name, name, 16)){
+			return tmpfile.inode;
+		}
+	}
+	return -1;
 }
 
-void init_inode(inode_t* inode){
-	(*inode).status = 0;
-	(*inode).numsector = 0;
-	(*inode).size = 0;
+int		path_lookup(char* path){
+	int inode = cwd;
+	char name[17];
 	int i;
-	for(i = 0; i < 7; ++i)
-	{
-		(*inode).toblock[i] = 0;
+	
+	if(path[0] == '/'){
+		inode = 0;//	start from root
 	}
-	(*inode).toinode = -1;
+	while(*path){
+		while(*path == '/'){
+			path++;
+		}
+		for(i = 0; path[i] != 0 && path[i] != '/'; ++i)
+		{
+			if(i == 16){
+				return -1;
+			}
+			name[i] = path[i];
+		}
+		if(i == 0){
+			break;
+		}
+		name[i] = 0;
+		path += i;
+		if((*maindisk).inode[inode].status != 1){//	only a dir can be walked into
+			return -1;
+		}
+		if((inode = dir_lookup(inode, name)) == -1){
+			return -1;
+		}
+	}
+	return inode;
 }
 
-void init_dir(inode_t* thisdirinode, inode_t* upperdirinode){// to be done
-	file_t* thisdir;
-	file_t* upperdir;
-	
-	//	this doesn't work
-	thisdir = (void*)maindisk + (*thisdirinode).toblock[0] * SD_SECTORSIZE;
-	upperdir = (void*)maindisk + (*thisdirinode).toblock[0] * SD_SECTORSIZE + sizeof(file_t);
+int		path_parent(char* path, char* name){
+	char* copy;
+	char* last;
+	int inode;
 	
+	if((copy = strdup(path)) == NULL){
+		return -1;
+	}
+	for(last = copy + strlen(copy); last > copy && last[-1] == '/'; --last);//	"a/b/" names b
+	*last = 0;
+	while(last > copy && last[-1] != '/'){
+		last--;
+	}
+	if(last[0] == 0 || strlen(last) > 16){
+		free(copy);
+		return -1;
+	}
+	strcpy(name, last);
+	if(last == copy){//	a name within the cwd
+		inode = cwd;
+	}
+	else if(last == copy + 1){//	a name within the root
+		inode = 0;
+	}
+	else{
+		last[-1] = 0;
+		inode = path_lookup(copy);
+	}
+	free(copy);
+	if(inode == -1 || (*maindisk).inode[inode].status != 1){
+		return -1;
+	}
+	return inode;
 }
 
-int findanemptysector(){
-	int ret;
-	unsigned char* bitmap=(*maindisk).bitmap;
-	for(ret = 1; ret < SD_NUMSECTORS; ++ret)
-	{
-		if(!(bitmap[ret/8] & (1<<(ret%8)))){
-			return ret;
+int		dir_set(int dirinode, char* name, char* newname, int inode){
+	char data[SD_SECTORSIZE] = "";
+	void* thisdir = inode_read(dirinode);
+	void* tmpdir;
+	void* tmpend;
+	file_t* tmpfile = thisdir;
+	int hr;
+	
+	if(thisdir == NULL){
+		return -1;
+	}
+	tmpend = (*maindisk).inode[dirinode].numsector * SD_SECTORSIZE + thisdir - sizeof(file_t);//	the last file
+	while(1){
+		if((void*)tmpfile >= tmpend){
+			if(name != NULL || inode_append(dirinode)){//	not found, or no room to grow
+				free(thisdir);
+				return -1;
+			}
+			tmpdir = malloc((*maindisk).inode[dirinode].numsector * SD_SECTORSIZE);//	as sfs_mkdir grows the dir
+			tmpfile = tmpdir + ((void*)tmpfile - thisdir);
+			memcpy(tmpdir, thisdir, ((*maindisk).inode[dirinode].numsector - 1) * SD_SECTORSIZE);
+			memcpy(tmpdir + ((*maindisk).inode[dirinode].numsector - 1) * SD_SECTORSIZE, data, SD_SECTORSIZE);
+			free(thisdir);
+			thisdir = tmpdir;
+			break;
+		}
+		if((*tmpfile).name[0] == 0){//	the end of the dir
+			if(name != NULL){
+				free(thisdir);
+				return -1;
+			}
+			break;
+		}
+		if(name != NULL && !strncmp((*tmpfile).name, name, 16)){
+			break;
 		}
+		tmpfile = (void*)tmpfile + sizeof(file_t);
 	}
-	
-	//puts("findanemptysector: no sector available.");
-	return -1;
+	memset((*tmpfile).name, 0, sizeof((*tmpfile).name));
+	strncpy((*tmpfile).name, newname, 16);
+	(*tmpfile).inode = inode;
+	hr = inode_write(dirinode, thisdir);
+	free(thisdir);
+	return hr;
 }
 
-int findanemptyinode(){
-	int ret;
-	for(ret = 0; ret < MAXINODE; ++ret)
+void	inode_stat(int inode, sfs_stat_t* st){
+	int tmpinode = inode;
+	int i, sector, prev = -1;
+	
+	(*st).inode = inode;
+	(*st).type = (*maindisk).inode[inode].status;
+	(*st).size = (*maindisk).inode[inode].size;
+	(*st).numsector = (*maindisk).inode[inode].numsector;
+	(*st).numinode = 1;
+	(*st).numextent = 0;
+	(*st).numhole = 0;
+	for(i = 0; i < (*maindisk).inode[inode].numsector; ++i)
 	{
-		if((*maindisk).inode[ret].toblock[0] == 0){
-			return ret;
+		if(i && i%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+			(*st).numinode++;
+		}
+		sector = (*maindisk).inode[tmpinode].toblock[i%7];
+		if(sector == 0){//	a hole breaks the run
+			(*st).numhole++;
+			prev = -1;
+			continue;
+		}
+		if(sector != prev + 1){//	a new run of contiguous sectors
+			(*st).numextent++;
 		}
+		prev = sector;
 	}
-	
-	//puts("findanemptyinode: no inode available!");
-	return -1;
 }
 
-void*	inode_read(int inode){
-	void* ret = malloc((*maindisk).inode[inode].numsector * SD_SECTORSIZE);
-	
+void	inode_frag(int inode, int* numrun, int* numgap, int* seek){
 	int tmpinode = inode;
-	int i = 0;
-	while(1){
-		while(SD_read((*maindisk).inode[tmpinode].toblock[i%7], ret + i * SD_SECTORSIZE));
-		i++;
-		if(i%7 ==0){
-			
+	int i, sector, last = 0, hole = 1;
+	
+	*numrun = 0;
+	*numgap = 0;
+	*seek = 0;
+	for(i = 0; i < (*maindisk).inode[inode].numsector; ++i)
+	{
+		if(i && i%7 == 0){
 			tmpinode = (*maindisk).inode[tmpinode].toinode;
 		}
-		if((tmpinode == -1) || ((*maindisk).inode[tmpinode].toblock[i%7] == 0)){
-			break;
+		sector = (*maindisk).inode[tmpinode].toblock[i%7];
+		if(sector == 0){//	a hole, the next sector starts a run however close it is
+			hole = 1;
+			continue;
+		}
+		if(hole){
+			(*numrun)++;
+		}
+		if(last != 0){//	reading skips the holes, the head goes straight on from the last sector
+			(*numgap)++;
+			*seek += abs(sector - last - 1);
 		}
+		last = sector;
+		hole = 0;
 	}
-	return ret;
 }
 
-int		inode_append(int inode){
-	int i = 0;
-	int tmpinode = inode;
-	while(1){
-		i++;
-		if(i%7 ==0){
-			if((*maindisk).inode[tmpinode].toinode == -1){
-				if(-1 == ((*maindisk).inode[tmpinode].toinode = findanemptyinode())){
-					return -1;
-				}
-				tmpinode = (*maindisk).inode[tmpinode].toinode;
-				if(-1 == ((*maindisk).inode[tmpinode].toblock[i%7] = findanemptysector())){
-					return -1;
-				}
-				fillbitmap((*maindisk).inode[tmpinode].toblock[i%7]);
-				(*maindisk).inode[inode].numsector++;
-				break;				
+int		file_relocate(int inode){
+	char data[SD_SECTORSIZE];
+	sfs_stat_t st;
+	int numrun, numgap, seek, start, found, count, i, sector, tmpinode;
+	
+	if(((*maindisk).inode[inode].status != 1 && (*maindisk).inode[inode].status != 2) || (*maindisk).inode[inode].numsector == 0){
+		return 0;
+	}
+	inode_stat(inode, &st);
+	inode_frag(inode, &numrun, &numgap, &seek);
+	if(st.numextent <= numrun){//	as few runs as its holes allow
+		return 0;
+	}
+	
+	//	sectors shared with snapshots or clones would be copied, not moved, and mapped ones are still read in place
+	pthread_mutex_lock(&cachelock);
+	tmpinode = inode;
+	for(i = 0; i < st.numsector; ++i)
+	{
+		if(i && i%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		sector = (*maindisk).inode[tmpinode].toblock[i%7];
+		if(sector != 0 && ((*snaptab).refcnt[sector] || (*snaptab).share[sector] || (cachemap[sector] != -1 && maincache[cachemap[sector]].pin))){
+			pthread_mutex_unlock(&cachelock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&cachelock);
+	if(journal_room(JCHANGE(2 * st.numsector))){//	the group switching it frees the old sectors and takes the new ones
+		return -1;
+	}
+	count = st.numsector - st.numhole;
+	if((start = findanemptyrun(group_of(inode) * GROUPSECTORS, count, &found)) == -1 || found < count){//	back in its group, near its dir
+		return 0;
+	}
+	
+	//	copy the data into the run, nothing points there yet
+	tmpinode = inode;
+	for(i = 0, count = 0; i < st.numsector; ++i)
+	{
+		if(i && i%7 == 0){
+			tmpinode = (*maindisk).inode[tmpinode].toinode;
+		}
+		if((sector = (*maindisk).inode[tmpinode].toblock[i%7]) == 0){
+			continue;
+		}
+		if(sector_read(sector, data)){
+			while(count > 0){//	the run stays free, with no checksum for its next owner to trip on
+				csumtab[start + --count] = 0;
 			}
+			return -1;
+		}
+		sector_write(start + count++, data);
+	}
+	
+	//	then point the file at it, in one group
+	tmpinode = inode;
+	for(i = 0, count = 0; i < st.numsector; ++i)
+	{
+		if(i && i%7 == 0){
 			tmpinode = (*maindisk).inode[tmpinode].toinode;
 		}
-		if((*maindisk).inode[tmpinode].toblock[i%7] == 0){
-			if(-1 == ((*maindisk).inode[tmpinode].toblock[i%7] = findanemptysector())){
-				return -1;
+		if((sector = (*maindisk).inode[tmpinode].toblock[i%7]) == 0){
+			continue;
+		}
+		emptybitmap(sector);
+		(*maindisk).inode[tmpinode].toblock[i%7] = start + count;
+		fillbitmap(start + count++);
+	}
+	if(journal_commit()){
+		return -1;
+	}
+	return count;
+}
+
+int		dir_sectors(int numentry){
+	int numsector = 1;
+	
+	//	the same bound as tmpend: a file_t goes in if it starts before the last sizeof(file_t) bytes
+	while((numentry - 1) * sizeof(file_t) >= numsector * SD_SECTORSIZE - sizeof(file_t)){
+		numsector++;
+	}
+	return numsector;
+}
+
+int		readreq_cmp(const void* a, const void* b){
+	return (*(readreq_t*)a).sector - (*(readreq_t*)b).sector;
+}
+
+void	image_free(sfs_imgent_t* ents, int numents){
+	int i;
+	
+	for(i = 0; i < numents; ++i)
+	{
+		free(ents[i].data);
+	}
+	free(ents);
+}
+
+void	cache_init(){
+	int i;
+	
+	if(maincache == 0){
+		maincache = malloc(NUMCACHE * sizeof(cache_t));
+	}
+	pthread_mutex_lock(&cachelock);
+	for(i = 0; i < NUMCACHE; ++i)
+	{
+		maincache[i].sector = 0;
+		maincache[i].pin = 0;
+		maincache[i].used = 0;
+		maincache[i].dirty = 0;
+	}
+	for(i = 0; i < SD_NUMSECTORS; ++i)
+	{
+		cachemap[i] = -1;
+	}
+	cachehand = 0;
+	numjdirty = 0;//	a group not committed yet is dropped with the cache
+	numtrans = 0;
+	pthread_mutex_unlock(&cachelock);
+}
+
+cache_t*	cache_get(int sector, int fill){
+	int slot = cachemap[sector];
+	int i;
+	
+	if(slot != -1){
+		maincache[slot].used = 1;
+		return &maincache[slot];
+	}
+	//	clock replacement, pinned entries are never taken; two rounds clear every used bit
+	for(i = 0; i < 2 * NUMCACHE; ++i)
+	{
+		slot = cachehand;
+		cachehand = (cachehand + 1) % NUMCACHE;
+		if(maincache[slot].pin > 0){
+			continue;
+		}
+		if(maincache[slot].used){
+			maincache[slot].used = 0;
+			continue;
+		}
+		if(maincache[slot].sector != 0){
+			cachemap[maincache[slot].sector] = -1;
+		}
+		maincache[slot].sector = sector;
+		maincache[slot].used = 1;
+		cachemap[sector] = slot;
+		if(fill){
+			while(SD_read(sector, maincache[slot].data));
+			if(csum_check(sector, maincache[slot].data)){//	a corrupt sector is never cached
+				cachemap[sector] = -1;
+				maincache[slot].sector = 0;
+				maincache[slot].used = 0;
+				return NULL;
 			}
-			fillbitmap((*maindisk).inode[tmpinode].toblock[i%7]);
-			(*maindisk).inode[inode].numsector++;
-			break;
 		}
+		return &maincache[slot];
 	}
-	return 0;
+	return NULL;
 }
 
-void	inode_write(int inode, void* data){
-	int i = 0;
-	int tmpinode = inode;
-	while(1){
-		while(SD_write((*maindisk).inode[tmpinode].toblock[i%7], (void*)data + i * SD_SECTORSIZE));
-			
-		i++;
-		if(i%7 ==0){
+int		fd_flush(int fd){
+	int inode = (*mainfptab).fptab[fd];
+	int hr;
+	
+	if((*mainfptab).wblen[fd] == 0){
+		return 0;
+	}
+	//	file_write sees the whole buffered extent at once, so its holes get one run of sectors
+	hr = file_write(inode, (*mainfptab).wbuf[fd], (*mainfptab).wbpos[fd], (*mainfptab).wblen[fd]);
+	(*mainfptab).wblen[fd] = 0;
+	wbowner[inode] = -1;
+	return hr;
+}
+
+int		file_flush(int inode){
+	if(wbowner[inode] == -1){
+		return 0;
+	}
+	return fd_flush(wbowner[inode]);
+}
+
+void	file_discard(int inode){
+	if(wbowner[inode] == -1){
+		return;
+	}
+	(*mainfptab).wblen[wbowner[inode]] = 0;
+	wbowner[inode] = -1;
+}
+
+void	file_readahead(int fd, int length){
+	int inode = (*mainfptab).fptab[fd];
+	int pos = (*mainfptab).pos[fd];
+	int numsector = (*maindisk).inode[inode].numsector;
+	int n, last, sector, tmpinode;
+	
+	if(pos == (*mainfptab).ranext[fd]){//	it picks up where the last read stopped, widen the window
+		(*mainfptab).rawin[fd] *= 2;
+		if((*mainfptab).rawin[fd] < MINREADAHEAD){
+			(*mainfptab).rawin[fd] = MINREADAHEAD;
+		}
+		if((*mainfptab).rawin[fd] > MAXREADAHEAD){
+			(*mainfptab).rawin[fd] = MAXREADAHEAD;
+		}
+	}
+	else{//	a seek, stop prefetching until the reads are sequential again
+		(*mainfptab).rawin[fd] = 0;
+		(*mainfptab).raend[fd] = 0;
+	}
+	(*mainfptab).ranext[fd] = pos + length;
+	if((*mainfptab).rawin[fd] == 0 || numsector == 0){
+		return;
+	}
+	//	the window starts at the sector the next read begins in, and what is prefetched already is skipped
+	n = (pos + length) / SD_SECTORSIZE;
+	last = n + (*mainfptab).rawin[fd];
+	if(last > numsector){
+		last = numsector;
+	}
+	if(n < (*mainfptab).raend[fd]){
+		n = (*mainfptab).raend[fd];
+	}
+	if(n >= last){
+		return;
+	}
+	(*mainfptab).raend[fd] = last;
+	tmpinode = inode_walk(inode, n);
+	pthread_mutex_lock(&cachelock);
+	while(n < last){
+		if((sector = (*maindisk).inode[tmpinode].toblock[n%7]) != 0){//	holes read as zeros without the disk
+			cache_prefetch(sector);
+		}
+		n++;
+		if(n%7 == 0 && n < last){
 			tmpinode = (*maindisk).inode[tmpinode].toinode;
 		}
-		if((tmpinode == -1) || ((*maindisk).inode[tmpinode].toblock[i%7] == 0)){//	it can't be
-			break;
+	}
+	pthread_mutex_unlock(&cachelock);
+}
+
+void	cache_prefetch(int sector){
+	cache_t* entry;
+	
+	if(cachemap[sector] != -1){
+		return;
+	}
+	//	left unused, a prefetched sector nobody reads goes at the next pass of the clock hand
+	if((entry = cache_get(sector, 1)) != NULL){
+		(*entry).used = 0;
+	}
+}
+
+int		sector_read(int sector, void* buf){
+	cache_t* entry;
+	int hr = 0;
+	
+	pthread_mutex_lock(&cachelock);
+	if((entry = cache_get(sector, 1)) != NULL){
+		memcpy(buf, (*entry).data, SD_SECTORSIZE);
+	}
+	else{//	every entry is pinned or the sector is corrupt, go around the cache
+		while(SD_read(sector, buf));
+		hr = csum_check(sector, buf);
+	}
+	pthread_mutex_unlock(&cachelock);
+	return hr;
+}
+
+int		sector_write(int sector, void* buf){
+	cache_t* entry;
+	
+	csumtab[sector] = csum_of(buf);
+	while(SD_write(sector, buf));
+	pthread_mutex_lock(&cachelock);
+	if((entry = cache_get(sector, 0)) != NULL){
+		memcpy((*entry).data, buf, SD_SECTORSIZE);
+	}
+	pthread_mutex_unlock(&cachelock);
+	return 0;
+}
+
+int		sector_cow(int* toblock){
+	int sector;
+	
+	if((*snaptab).refcnt[*toblock] == 0 && (*snaptab).share[*toblock] == 0){
+		return *toblock;
+	}
+	if((sector = findanemptysector(*toblock)) == -1){//	next to the one it replaces
+		return -1;
+	}
+	fillbitmap(sector);
+	if((*snaptab).share[*toblock]){//	one file fewer has the old one
+		(*snaptab).share[*toblock]--;
+	}
+	*toblock = sector;//	the old one stays with the snapshots or the other files, the caller writes all of the new one
+	return sector;
+}
+
+int		snap_find(char* name){
+	int i;
+	
+	for(i = 0; i < MAXSNAP; ++i)
+	{
+		if((*snaptab).snap[i].name[0] != 0 && strncmp((*snaptab).snap[i].name, name, SNAPNAMELEN) == 0){
+			return i;
 		}
 	}
+	return -1;
 }
 
-void	inode_erase(int inode){
-	int tmpinode = inode;
-	int preinode;
-	int i = 0;
-	while(1){
-		emptybitmap((*maindisk).inode[tmpinode].toblock[i%7]);
-		
-		i++;
-		if(i%7 ==0){
-			preinode = tmpinode;
-			tmpinode = (*maindisk).inode[tmpinode].toinode;
-			init_inode(&((*maindisk).inode[preinode]));
+void	snap_count(inode_t* table, int numinode, unsigned short* map){
+	int i, n, sector, tmpinode;
+	
+	for(i = 0; i < numinode; ++i)
+	{
+		if((table[i].status != 1 && table[i].status != 2) || table[i].numsector <= 0){
+			continue;
 		}
-		if(tmpinode == -1){
-			break;
+		tmpinode = i;
+		for(n = 0; n < table[i].numsector; ++n)
+		{
+			if(n && n%7 == 0){
+				tmpinode = table[tmpinode].toinode;
+				if(tmpinode <= 0 || tmpinode >= numinode){//	a broken chain, fsck's business
+					break;
+				}
+			}
+			sector = table[tmpinode].toblock[n%7];
+			if(sector > 0 && sector < SD_NUMSECTORS){
+				map[sector]++;
+			}
 		}
-		if((*maindisk).inode[tmpinode].toblock[i%7] == 0){
-			init_inode(&((*maindisk).inode[tmpinode]));
-			break;
-		}	
 	}
-}
\ No newline at end of file
+}
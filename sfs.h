@@ -24,15 +24,90 @@
 
 #include "stdio.h"
 
+typedef struct {// one directory entry returned by sfs_readdir
+	char	name[17];
+	int		inode;// inodeID of the entry
+	int		type;// 1 means it is a directory, 2 means it is a file
+	int		size;// size in bytes of the entry
+} sfs_dirent_t;
+
+typedef struct {// one buffer of a sfs_readv/sfs_writev batch
+	char*	base;
+	int		len;
+} sfs_iovec_t;
+
+typedef struct {// a read-only view of file data handed out by sfs_mapread
+	const char*	base;
+	int		len;
+	int		sector;// the sector it is pinned in, 0 for holes and data kept in the inode
+} sfs_span_t;
+
+typedef struct {// file information returned by sfs_stat and sfs_fstat
+	int		inode;// inodeID of the file
+	int		type;// 1 means it is a directory, 2 means it is a file
+	int		size;// size in bytes
+	int		numsector;// how many sectors are used
+	int		numinode;// how many inodes are in its toinode chain
+	int		numextent;// how many runs of contiguous sectors
+	int		numhole;// how many of the sectors are holes, with nothing allocated
+} sfs_stat_t;
+
+typedef struct {// fragmentation of the files and dirs, returned by sfs_fragstat
+	int		numfile;// files and dirs with at least one sector
+	int		numextent;// runs of contiguous sectors over all of them
+	int		numfragmented;// files and dirs in more runs than their holes make
+	double	extentperfile;// numextent / numfile
+	double	avgseek;// sectors skipped on average going from one sector of a file to its next, 0 when all are contiguous
+} sfs_fragstat_t;
+
+typedef struct {// one file or dir to put in the image sfs_mkimage builds
+	char	name[17];
+	int		parent;// the index of its dir in the array, which comes before it; entry 0 is the root
+	int		type;// 1 means it is a directory, 2 means it is a file
+	int		size;// size in bytes of a file
+	char*	data;// the size bytes of a file
+} sfs_imgent_t;
+
 extern int sfs_mkfs();
+extern int sfs_mount();
 extern int sfs_mkdir(char *name);
 extern int sfs_fcd(char* name);
 extern int sfs_ls(FILE* f);
+extern int sfs_opendir(char* name);
+extern int sfs_readdir(int dirID, sfs_dirent_t* entry);
+extern int sfs_telldir(int dirID);
+extern int sfs_seekdir(int dirID, int position);
+extern int sfs_closedir(int dirID);
 extern int sfs_fopen(char* name);
 extern int sfs_fclose(int fileID);
 extern int sfs_fread(int fileID, char *buffer, int length);
 extern int sfs_fwrite(int fileID, char *buffer, int length);
+extern int sfs_pread(int fileID, char *buffer, int length, int offset);
+extern int sfs_pwrite(int fileID, char *buffer, int length, int offset);
+extern int sfs_mapread(int fileID, int offset, int length, sfs_span_t* spans, int maxspans);
+extern int sfs_unmap(sfs_span_t* spans, int numspans);
+extern int sfs_readv(int fileID, sfs_iovec_t* iov, int iovcnt);
+extern int sfs_writev(int fileID, sfs_iovec_t* iov, int iovcnt);
 extern int sfs_lseek(int fileID, int position);
 extern int sfs_rm(char *file_name);
+extern int sfs_rm_recursive(char* name);
+extern int sfs_rename(char* oldpath, char* newpath);
+extern int sfs_stat(char* name, sfs_stat_t* st);
+extern int sfs_fstat(int fileID, sfs_stat_t* st);
+extern int sfs_fallocate(int fileID, int offset, int length);
+extern int sfs_truncate(char* name, int length);
+extern int sfs_ftruncate(int fileID, int length);
+extern int sfs_fsync(int fileID);
+extern int sfs_sync();
+extern int sfs_fsck(FILE* f, int numthreads);
+extern int sfs_snapshot(char* name);
+extern int sfs_snapdelete(char* name);
+extern int sfs_snapmount(char* name);
+extern int sfs_clone(char* src, char* dst);
+extern int sfs_fragstat(sfs_fragstat_t* st);
+extern int sfs_defrag(int maxsectors);
+extern int sfs_mkimage(sfs_imgent_t* ents, int numents);
+extern int sfs_readimage(sfs_imgent_t** ents);
+extern unsigned int sfs_crc32c(unsigned int crc, const void* data, int len);
 
 #endif /* !SFS_H */
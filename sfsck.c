@@ -0,0 +1,80 @@
+/* -*-C-*-
+ *******************************************************************************
+ *
+ * File:         sfsck.c
+ * Description:  Consistency checker for Simple File System disk images
+ * Language:     C
+ * Package:      N/A
+ * Status:       Experimental (Do Not Distribute)
+ *
+ *******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "sdisk.h"
+#include "sfs.h"
+
+/*
+ * usage: report usage to given stream and exit
+ *
+ * Parameters: Where to report usage and our exit status
+ *
+ * Returns: -
+ *
+ */
+void usage(char *program_name, FILE* stream, int status) {
+    fprintf(stream, "Usage: %s -h -t THREADS -f FILE\n"
+        "Check the consistency of a simple file system disk image.\n"
+        "   -h \tthis help message\n"
+        "   -t THREADS \thow many threads check the inode table (default: one per cpu)\n"
+        "   -f FILE \tdisk image file, it is not changed\n"
+        "Each problem found is a line \"problem key=value ...\", then a summary line.\n"
+        "The exit status is 0 for a clean image, 1 if problems were found, 2 on error.\n",
+        program_name);
+    exit(status);
+} /* !usage */
+
+int main(int argc, char* argv[]) {
+    int c, problems;
+    int numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    char* program_name = argv[0];
+    char* diskFName = NULL;
+
+    while ((c = getopt(argc, argv, "ht:f:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(program_name, stdout, 0);
+            break;
+        case 't':
+            numthreads = atoi(optarg);
+            break;
+        case 'f':
+            diskFName = optarg;
+            break;
+        default:
+            usage(program_name, stderr, 2);
+            break;
+        }
+    }
+    if (diskFName == NULL || numthreads < 1) {
+        usage(program_name, stderr, 2);
+    }
+
+    if (SD_initDisk() || SD_loadDisk(diskFName)) {
+        fprintf(stderr, "Error %d while reading disk image from %s\n", sderrno, diskFName);
+        return 2;
+    }
+    // the journal is replayed in memory only, the image file is never saved
+    if (sfs_mount()) {
+        fprintf(stderr, "%s holds no file system or its header is corrupt\n", diskFName);
+        return 2;
+    }
+    problems = sfs_fsck(stdout, numthreads);
+    if (problems < 0) {
+        fprintf(stderr, "Error while checking %s\n", diskFName);
+        return 2;
+    }
+    return (problems > 0) ? 1 : 0;
+} /* !main */
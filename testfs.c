@@ -30,6 +30,7 @@
 #include "config.h"
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 
 //char* program_name;
 bool gbIsVerbose = 0; // verbose mode flag
@@ -56,6 +57,33 @@ int multipleOpenFilesTest();
 int nestedFoldersTest();
 int errorTest();
 int removeTest();
+int readdirTest();
+int statTest();
+int inlineFileTest();
+int sparseFileTest();
+int fallocateTest();
+int truncateTest();
+int positionalTest();
+int vectoredTest();
+int mapReadTest();
+int readaheadTest();
+int writeBufferTest();
+int syncTest();
+int journalTest();
+int fsckTest();
+int checksumTest();
+int checksumCrashTest();
+int crcTest();
+int incrementalSaveTest();
+int compressedImageTest();
+int snapshotTest();
+int cloneTest();
+int defragTest();
+int localityTest();
+int mkimageTest();
+int readimageTest();
+int rmRecursiveTest();
+int renameTest();
 int perfTest();
 
 // Tests helpers
@@ -76,6 +104,8 @@ int refreshDisk();
 void initBuffer(char *buf, int fsize);
 int checkBuffers(char *buf, char *cpy, int fsize, int offset);
 int testFile(char* name, int fsize);
+unsigned int crc32cBitwise(unsigned char *data, int len);
+int usedSectors();
 
 /*
  * usage: report usage to given stream and exit
@@ -168,6 +198,33 @@ int runTests() {
     RUN_TEST(multipleOpenFilesTest());
     RUN_TEST(nestedFoldersTest());
     RUN_TEST(errorTest());
+    RUN_TEST(readdirTest());
+    RUN_TEST(statTest());
+    RUN_TEST(inlineFileTest());
+    RUN_TEST(sparseFileTest());
+    RUN_TEST(fallocateTest());
+    RUN_TEST(truncateTest());
+    RUN_TEST(positionalTest());
+    RUN_TEST(vectoredTest());
+    RUN_TEST(mapReadTest());
+    RUN_TEST(readaheadTest());
+    RUN_TEST(writeBufferTest());
+    RUN_TEST(syncTest());
+    RUN_TEST(journalTest());
+    RUN_TEST(fsckTest());
+    RUN_TEST(checksumTest());
+    RUN_TEST(checksumCrashTest());
+    RUN_TEST(crcTest());
+    RUN_TEST(incrementalSaveTest());
+    RUN_TEST(compressedImageTest());
+    RUN_TEST(snapshotTest());
+    RUN_TEST(cloneTest());
+    RUN_TEST(defragTest());
+    RUN_TEST(localityTest());
+    RUN_TEST(mkimageTest());
+    RUN_TEST(readimageTest());
+    RUN_TEST(rmRecursiveTest());
+    RUN_TEST(renameTest());
 #else
     f_ls_compTest = fopen("compTest.ls", "w");
     f_ls = f_ls_compTest;
@@ -715,13 +772,2227 @@ int errorTest() {
     int fd = sfs_fopen("foo");
     FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
 
-    FAIL_BRK3((sfs_lseek(fd, fsize) != -1), stdout,
-            "Error: Allowing seek pass the end of the file\n");
+    FAIL_BRK3((sfs_lseek(fd, -1) != -1), stdout,
+            "Error: Allowing seek before the beginning of the file\n");
+
+    // seeking pass the end of the file is fine, but there is nothing to read there
+    FAIL_BRK3((sfs_lseek(fd, fsize) != fsize), stdout,
+            "Error: Seeking to the end of the file failed\n");
+    FAIL_BRK3((sfs_fread(fd, buf, 1) != -1), stdout,
+            "Error: Allowing read pass the end of the file\n");
+
+    Fail:
+
+    saveAndCloseDisk();
+    PRINT_RESULTS("Error Test");
+    return hr;
+}
+
+/**
+ * Tests streaming the entries of a directory with sfs_opendir/sfs_readdir
+ */
+int readdirTest() {
+    int hr = SUCCESS;
+    int i, dd = -1, ret, pos, numEntries = 60, numFiles = 0, numDirs = 0;
+    char name[16];
+    sfs_dirent_t entry;
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // enough entries to spread the directory over several sectors
+    for (i = 0; i < numEntries; i++) {
+        sprintf(name, "file%04d", i);
+        FAIL_BRK4(createSmallFile(name, "abcdefgh", i % 8 + 1));
+        sprintf(name, "dir%04d", i);
+        FAIL_BRK3(sfs_mkdir(name), stdout,
+                "Error: Creating folder (%s) failed\n", name);
+    }
+    FAIL_BRK3(sfs_rm("file0000"), stdout, "Error: deleting file failed\n");
+
+    dd = sfs_opendir(".");
+    FAIL_BRK3((dd == -1), stdout, "Error: opendir for . failed\n");
+    while ((ret = sfs_readdir(dd, &entry)) == 1) {
+        if (entry.type == 2) {
+            numFiles++;
+            FAIL_BRK3((entry.size != atoi(entry.name + 4) % 8 + 1), stdout,
+                    "Error: wrong size %d for (%s)\n", entry.size, entry.name);
+        } else if (entry.type == 1) {
+            numDirs++;
+        }
+    }
+    FAIL_BRK3((ret != 0), stdout, "Error: readdir failed\n");
+    FAIL_BRK3((numFiles != numEntries - 1 || numDirs != numEntries + 2),
+            stdout, "Error: readdir returned %d files and %d dirs\n",
+            numFiles, numDirs);
+
+    // the cursor can be resumed
+    FAIL_BRK3(sfs_seekdir(dd, 0), stdout, "Error: seekdir failed\n");
+    FAIL_BRK3((sfs_readdir(dd, &entry) != 1 || strcmp(entry.name, ".")),
+            stdout, "Error: readdir after seekdir failed\n");
+    FAIL_BRK3(((pos = sfs_telldir(dd)) == -1), stdout, "Error: telldir failed\n");
+    FAIL_BRK3((sfs_readdir(dd, &entry) != 1 || strcmp(entry.name, "..")),
+            stdout, "Error: readdir of .. failed\n");
+    FAIL_BRK3(sfs_closedir(dd), stdout, "Error: closedir failed\n");
+    FAIL_BRK3((sfs_readdir(dd, &entry) != -1), stdout,
+            "Error: Allowing readdir of a closed stream\n");
+
+    // a sub folder only has . and ..
+    dd = sfs_opendir("dir0001");
+    FAIL_BRK3((dd == -1), stdout, "Error: opendir for dir0001 failed\n");
+    FAIL_BRK3((sfs_readdir(dd, &entry) != 1 || sfs_readdir(dd, &entry) != 1),
+            stdout, "Error: readdir of dir0001 failed\n");
+    FAIL_BRK3((sfs_readdir(dd, &entry) != 0), stdout,
+            "Error: readdir of dir0001 did not end\n");
+    FAIL_BRK3(sfs_closedir(dd), stdout, "Error: closedir failed\n");
+    FAIL_BRK3((sfs_opendir("nodir") != -1), stdout,
+            "Error: Allowing opendir of a folder that does not exist\n");
+    FAIL_BRK3((sfs_opendir("dir000") != -1), stdout,
+            "Error: Allowing opendir of a prefix of a folder name\n");
+    FAIL_BRK3((sfs_opendir("file0001") != -1), stdout,
+            "Error: Allowing opendir of a file\n");
+
+    Fail:
+
+    saveAndCloseDisk();
+    PRINT_RESULTS("Readdir Test");
+    return hr;
+}
+
+/**
+ * Tests sfs_stat/sfs_fstat by name, by path and by file descriptor
+ */
+int statTest() {
+    int hr = SUCCESS;
+    int fd, fsize = SD_SECTORSIZE * 20 + 10;
+    char *buffer = malloc(fsize);
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    FAIL_BRK4(createSmallFile("foo", buffer, 1500));
+    FAIL_BRK3(sfs_stat("foo", &st), stdout, "Error: stat of foo failed\n");
+    FAIL_BRK3((st.type != 2 || st.size != 1500 || st.numsector < 3
+            || st.numinode != 1 || st.numextent < 1), stdout,
+            "Error: wrong stat for foo\n");
+
+    // a file in a sub folder, by absolute and relative path
+    FAIL_BRK4(createFolder("bar"));
+    FAIL_BRK4(sfs_fcd("bar"));
+    FAIL_BRK4(createSmallFile("big", buffer, fsize));
+    FAIL_BRK4(sfs_fcd("/"));
+    FAIL_BRK3(sfs_stat("/bar/big", &st), stdout, "Error: stat of /bar/big failed\n");
+    FAIL_BRK3((st.type != 2 || st.size != fsize || st.numsector < 21
+            || st.numinode != 3), stdout, "Error: wrong stat for /bar/big\n");
+    FAIL_BRK3(sfs_stat("bar/./big", &st), stdout, "Error: stat of bar/./big failed\n");
+    FAIL_BRK3(sfs_stat("bar", &st), stdout, "Error: stat of bar failed\n");
+    FAIL_BRK3((st.type != 1), stdout, "Error: bar is not a folder\n");
+
+    // by file descriptor
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 2000) != 2000), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fstat(fd, &st), stdout, "Error: fstat failed\n");
+    FAIL_BRK3((st.size != 2000), stdout, "Error: fstat size is %d\n", st.size);
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    // bogus arguments
+    FAIL_BRK3((sfs_fstat(fd, &st) != -1), stdout,
+            "Error: Allowing fstat of a closed file\n");
+    FAIL_BRK3((sfs_stat("nofile", &st) != -1), stdout,
+            "Error: Allowing stat of a file that does not exist\n");
+    FAIL_BRK3((sfs_stat("foo/bar", &st) != -1), stdout,
+            "Error: Allowing stat through a file\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Stat Test");
+    return hr;
+}
+
+/**
+ * Tests tiny files that are kept inside their inode, and their growth out of it
+ */
+int inlineFileTest() {
+    int hr = SUCCESS;
+    int fd, fsize = 600;
+    char *buffer = malloc(fsize);
+    char *cpy = malloc(fsize);
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // empty and tiny files do not take a sector
+    fd = sfs_fopen("empty");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for empty failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK4(createSmallFile("one", buffer, 1));
+    FAIL_BRK4(createSmallFile("tiny", buffer, 20));
+    FAIL_BRK3((sfs_stat("empty", &st) || st.size != 0 || st.numsector != 0),
+            stdout, "Error: empty file took a sector\n");
+    FAIL_BRK3((sfs_stat("tiny", &st) || st.size != 20 || st.numsector != 0),
+            stdout, "Error: tiny file took a sector\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK4(verifyFile("one", buffer, 1));
+    FAIL_BRK4(verifyFile("tiny", buffer, 20));
+
+    // append to the tiny file until it needs sectors of its own
+    fd = sfs_fopen("tiny");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
+    FAIL_BRK3((sfs_lseek(fd, 19) != 19), stdout, "Error: Seeking failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer + 19, fsize - 19) != fsize - 19), stdout,
+            "Error: Appending write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3((sfs_stat("tiny", &st) || st.size != fsize || st.numsector < 2),
+            stdout, "Error: wrong stat after growing the file\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK4(verifyFile("tiny", buffer, fsize));
+
+    // removing them frees the inodes for reuse
+    FAIL_BRK3(sfs_rm("one"), stdout, "Error: deleting file failed\n");
+    FAIL_BRK3(sfs_rm("tiny"), stdout, "Error: deleting file failed\n");
+    FAIL_BRK4(createSmallFile("again", buffer + 1, 10));
+    FAIL_BRK4(verifyFile("again", buffer + 1, 10));
+    fd = sfs_fopen("one");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for one failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, 1) != -1), stdout,
+            "Error: Allowing read of a removed file's data\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Inline File Test");
+    return hr;
+}
+
+/**
+ * Tests writing pass the end of a file, leaving holes that read as zeros
+ */
+int sparseFileTest() {
+    int hr = SUCCESS;
+    int i, fd, holeStart = 700, dataStart = 100 * SD_SECTORSIZE + 17;
+    int fsize = dataStart + 600;
+    char *buffer = malloc(holeStart);
+    char *cpy = malloc(fsize);
+    sfs_stat_t st;
+    initBuffer(buffer, holeStart);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    fd = sfs_fopen("sparse");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for sparse failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, holeStart) != holeStart), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3((sfs_lseek(fd, dataStart) != dataStart), stdout,
+            "Error: Seeking pass the end of the file failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 600) != 600), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    // only the sectors with data are allocated
+    FAIL_BRK3(sfs_stat("sparse", &st), stdout, "Error: stat failed\n");
+    FAIL_BRK3((st.size != fsize || st.numsector - st.numhole > 4), stdout,
+            "Error: size %d with %d of %d sectors allocated\n", st.size,
+            st.numsector - st.numhole, st.numsector);
+
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    fd = sfs_fopen("sparse");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, fsize) != fsize), stdout, "Error: Read failed\n");
+    FAIL_BRK3(checkBuffers(buffer, cpy, holeStart, 0), stdout,
+            "Error: Contents before the hole don't match\n");
+    for (i = holeStart; i < dataStart; i++) {
+        FAIL_BRK3((cpy[i] != 0), stdout, "Error: hole is not zero at %d\n", i);
+    }
+    FAIL_BRK3(checkBuffers(buffer, cpy + dataStart, 600, 0), stdout,
+            "Error: Contents after the hole don't match\n");
+
+    // filling part of the hole
+    FAIL_BRK3((sfs_lseek(fd, 50 * SD_SECTORSIZE) != 50 * SD_SECTORSIZE), stdout,
+            "Error: Seeking into the hole failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 10) != 10), stdout, "Error: Write failed\n");
+    FAIL_BRK3((sfs_lseek(fd, 50 * SD_SECTORSIZE - 5) != 50 * SD_SECTORSIZE - 5),
+            stdout, "Error: Seeking into the hole failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, 20) != 20), stdout, "Error: Read failed\n");
+    for (i = 0; i < 20; i++) {
+        FAIL_BRK3((cpy[i] != ((i < 5 || i >= 15)? 0 : buffer[i - 5])), stdout,
+                "Error: Contents around the filled hole don't match at %d\n", i);
+    }
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    // a tiny file that jumps far away
+    fd = sfs_fopen("jump");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for jump failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 5) != 5), stdout, "Error: Write failed\n");
+    FAIL_BRK3((sfs_lseek(fd, 3000) != 3000), stdout, "Error: Seeking failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 5) != 5), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = sfs_fopen("jump");
+    FAIL_BRK3((sfs_fread(fd, cpy, 3005) != 3005), stdout, "Error: Read failed\n");
+    FAIL_BRK3((checkBuffers(buffer, cpy, 5, 0) || checkBuffers(buffer, cpy + 3000, 5, 0)),
+            stdout, "Error: Contents of jump don't match\n");
+    for (i = 5; i < 3000; i++) {
+        FAIL_BRK3((cpy[i] != 0), stdout, "Error: gap is not zero at %d\n", i);
+    }
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_rm("sparse"), stdout, "Error: deleting file failed\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Sparse File Test");
+    return hr;
+}
+
+/**
+ * Tests that sfs_fallocate keeps files written side by side contiguous
+ */
+int fallocateTest() {
+    int hr = SUCCESS;
+    int i, fd, fd2, chunk = 96, fsize = 30 * SD_SECTORSIZE;
+    char name[16];
+    char *buffer = malloc(fsize);
+    char *buffer2 = malloc(fsize);
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+    initBuffer(buffer2, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    fd = sfs_fopen("first");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for first failed\n");
+    fd2 = sfs_fopen("second");
+    FAIL_BRK3((fd2 == -1), stdout, "Error: fopen for second failed\n");
+    FAIL_BRK3(sfs_fallocate(fd, 0, fsize), stdout, "Error: fallocate failed\n");
+    FAIL_BRK3(sfs_fallocate(fd2, 0, fsize), stdout, "Error: fallocate failed\n");
+    FAIL_BRK3((sfs_fstat(fd, &st) || st.size != 0 || st.numextent != 1), stdout,
+            "Error: fallocate did not reserve one run\n");
+
+    // growing both files at the same time
+    for (i = 0; i < fsize; i += chunk) {
+        FAIL_BRK3((sfs_fwrite(fd, buffer + i, chunk) != chunk), stdout,
+                "Error: Write failed\n");
+        FAIL_BRK3((sfs_fwrite(fd2, buffer2 + i, chunk) != chunk), stdout,
+                "Error: Write failed\n");
+    }
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_fclose(fd2), stdout, "Error: Closing the file failed\n");
+
+    FAIL_BRK3((sfs_stat("first", &st) || st.size != fsize || st.numextent != 1),
+            stdout, "Error: first is in %d runs\n", st.numextent);
+    FAIL_BRK3((sfs_stat("second", &st) || st.size != fsize || st.numextent != 1),
+            stdout, "Error: second is in %d runs\n", st.numextent);
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK4(verifyFile("first", buffer, fsize));
+    FAIL_BRK4(verifyFile("second", buffer2, fsize));
+
+    // bogus arguments
+    FAIL_BRK3((sfs_fallocate(fd, 0, fsize) != -1), stdout,
+            "Error: Allowing fallocate of a closed file\n");
+
+    // a reservation that maps hundreds of inodes is a transaction of its own, after a busy group
+    for (i = 0; i < 12; i++) {
+        sprintf(name, "f%d", i);
+        FAIL_BRK4(createSmallFile(name, buffer, 10));
+    }
+    fd = sfs_fopen("big");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for big failed\n");
+    FAIL_BRK3(sfs_fallocate(fd, 0, 1400 * SD_SECTORSIZE), stdout, "Error: fallocate failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync after a big fallocate failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_stat("big", &st) || st.numsector != 1400 || st.numextent != 1), stdout,
+            "Error: big has %d sectors in %d runs after a remount\n", st.numsector, st.numextent);
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems after a big fallocate\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(buffer2);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Fallocate Test");
+    return hr;
+}
+
+/**
+ * Tests sfs_truncate/sfs_ftruncate, shrinking files and growing them with holes
+ */
+int truncateTest() {
+    int hr = SUCCESS;
+    int i, fd, fsize = 40 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *cpy = malloc(fsize);
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    FAIL_BRK4(createSmallFile("foo", buffer, fsize));
+    FAIL_BRK3(sfs_truncate("foo", 1000), stdout, "Error: truncate failed\n");
+    FAIL_BRK3((sfs_stat("foo", &st) || st.size != 1000 || st.numsector != 2
+            || st.numinode != 1), stdout, "Error: wrong stat after truncate\n");
+    FAIL_BRK4(verifyFile("foo", buffer, 1000));
+
+    // growing it back leaves zeros after the old end
+    FAIL_BRK3(sfs_truncate("foo", 5000), stdout, "Error: truncate failed\n");
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, fsize) != 5000), stdout, "Error: Read failed\n");
+    FAIL_BRK3(checkBuffers(buffer, cpy, 1000, 0), stdout,
+            "Error: Contents don't match\n");
+    for (i = 1000; i < 5000; i++) {
+        FAIL_BRK3((cpy[i] != 0), stdout, "Error: not zero at %d\n", i);
+    }
+
+    // rotating a log many times over the size of the disk
+    for (i = 0; i < 200; i++) {
+        FAIL_BRK3(sfs_ftruncate(fd, 0), stdout, "Error: ftruncate failed\n");
+        FAIL_BRK3((sfs_lseek(fd, 0) != 0), stdout, "Error: Seeking failed\n");
+        FAIL_BRK3((sfs_fwrite(fd, buffer, fsize) != fsize), stdout,
+                "Error: Write failed at rotation %d\n", i);
+    }
+    FAIL_BRK3(sfs_ftruncate(fd, 0), stdout, "Error: ftruncate failed\n");
+    FAIL_BRK3((sfs_fstat(fd, &st) || st.size != 0 || st.numsector != 0
+            || st.numinode != 1), stdout, "Error: wrong stat after truncate to 0\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    // bogus arguments
+    FAIL_BRK3((sfs_truncate("nofile", 0) != -1), stdout,
+            "Error: Allowing truncate of a file that does not exist\n");
+    FAIL_BRK3((sfs_truncate("/", 0) != -1), stdout,
+            "Error: Allowing truncate of a folder\n");
+    FAIL_BRK3((sfs_ftruncate(fd, 0) != -1), stdout,
+            "Error: Allowing ftruncate of a closed file\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Truncate Test");
+    return hr;
+}
+
+/**
+ * Tests sfs_pread/sfs_pwrite at explicit offsets, leaving the position alone
+ */
+int positionalTest() {
+    int hr = SUCCESS;
+    int i, fd, offset, fsize = 12 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *cpy = malloc(fsize);
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+
+    // write the file back to front, in chunks of different sizes
+    for (offset = fsize; offset > 0; offset -= i) {
+        i = (offset >= 700)? 700 : offset;
+        FAIL_BRK3((sfs_pwrite(fd, buffer + offset - i, i, offset - i) != i), stdout,
+                "Error: pwrite at %d failed\n", offset - i);
+    }
+    FAIL_BRK3((sfs_pread(fd, cpy, fsize, 0) != fsize), stdout, "Error: pread failed\n");
+    FAIL_BRK3(checkBuffers(buffer, cpy, fsize, 0), stdout, "Error: Contents don't match\n");
+
+    // the position of the file descriptor did not move
+    FAIL_BRK3((sfs_fread(fd, cpy, 10) != 10), stdout, "Error: Read failed\n");
+    FAIL_BRK3(checkBuffers(buffer, cpy, 10, 0), stdout,
+            "Error: fread did not start from the beginning\n");
+
+    // random offsets, reading at the end is clipped
+    for (i = 0; i < 50; i++) {
+        offset = rand() % fsize;
+        FAIL_BRK3((sfs_pread(fd, cpy, 100, offset) != ((fsize - offset < 100)? fsize - offset : 100)),
+                stdout, "Error: pread at %d failed\n", offset);
+        FAIL_BRK3(checkBuffers(buffer + offset, cpy, (fsize - offset < 100)? fsize - offset : 100, 0),
+                stdout, "Error: Contents at %d don't match\n", offset);
+    }
+    FAIL_BRK3((sfs_pread(fd, cpy, 10, fsize) != -1), stdout,
+            "Error: Allowing pread pass the end of the file\n");
+    FAIL_BRK3((sfs_pread(fd, cpy, 10, -1) != -1), stdout,
+            "Error: Allowing pread before the beginning of the file\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer, 10, 0) != -1), stdout,
+            "Error: Allowing pwrite to a closed file\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Positional Read Write Test");
+    return hr;
+}
+
+/**
+ * Tests sfs_readv/sfs_writev with records made of several buffers
+ */
+int vectoredTest() {
+    int hr = SUCCESS;
+    int i, fd, numRecords = 20, recSize = 16 + 300 + 8;
+    char header[16], trailer[8];
+    char *payload = malloc(300);
+    char *expected = malloc(numRecords * recSize);
+    char *cpy = malloc(numRecords * recSize);
+    sfs_iovec_t iov[3];
+    initBuffer(header, 16);
+    initBuffer(trailer, 8);
+    initBuffer(payload, 300);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    fd = sfs_fopen("records");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for records failed\n");
+    iov[0].base = header;
+    iov[0].len = 16;
+    iov[1].base = payload;
+    iov[1].len = 300;
+    iov[2].base = trailer;
+    iov[2].len = 8;
+    for (i = 0; i < numRecords; i++) {
+        header[0] = (char) i;
+        FAIL_BRK3((sfs_writev(fd, iov, 3) != recSize), stdout,
+                "Error: writev of record %d failed\n", i);
+        memcpy(expected + i * recSize, header, 16);
+        memcpy(expected + i * recSize + 16, payload, 300);
+        memcpy(expected + i * recSize + 316, trailer, 8);
+    }
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK4(verifyFile("records", expected, numRecords * recSize));
+
+    // read the records back into their three parts
+    fd = sfs_fopen("records");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
+    for (i = 0; i < numRecords; i++) {
+        iov[0].base = cpy + i * recSize;
+        iov[1].base = cpy + i * recSize + 16;
+        iov[2].base = cpy + i * recSize + 316;
+        FAIL_BRK3((sfs_readv(fd, iov, 3) != recSize), stdout,
+                "Error: readv of record %d failed\n", i);
+    }
+    FAIL_BRK3(checkBuffers(expected, cpy, numRecords * recSize, 0), stdout,
+            "Error: Contents don't match\n");
+
+    // at the end of the file only what is left is read
+    FAIL_BRK3((sfs_lseek(fd, numRecords * recSize - 20) == -1), stdout,
+            "Error: Seeking failed\n");
+    FAIL_BRK3((sfs_readv(fd, iov, 3) != 20), stdout, "Error: short readv failed\n");
+    FAIL_BRK3((sfs_readv(fd, iov, 3) != -1), stdout,
+            "Error: Allowing readv pass the end of the file\n");
+    iov[1].len = -1;
+    FAIL_BRK3((sfs_writev(fd, iov, 3) != -1), stdout,
+            "Error: Allowing writev of a bogus buffer\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    Fail:
+
+    SAFE_FREE(payload);
+    SAFE_FREE(expected);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Vectored Read Write Test");
+    return hr;
+}
+
+/**
+ * Tests the zero-copy views of sfs_mapread, also while other reads go through the cache
+ */
+int mapReadTest() {
+    int hr = SUCCESS;
+    int i, fd, fd2, numSpans, got, fsize = 6 * SD_SECTORSIZE + 100;
+    int bigSize = 300 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *big = malloc(bigSize);
+    char *cpy = malloc(fsize);
+    sfs_span_t spans[16];
+    initBuffer(buffer, fsize);
+    initBuffer(big, bigSize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // a file with a hole in its second sector
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer, SD_SECTORSIZE, 0) != SD_SECTORSIZE), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer + 2 * SD_SECTORSIZE, fsize - 2 * SD_SECTORSIZE,
+            2 * SD_SECTORSIZE) != fsize - 2 * SD_SECTORSIZE), stdout, "Error: Write failed\n");
+    memset(buffer + SD_SECTORSIZE, 0, SD_SECTORSIZE);
+    FAIL_BRK4(createSmallFile("big", big, bigSize));
+
+    numSpans = sfs_mapread(fd, 10, fsize, spans, 16);
+    FAIL_BRK3((numSpans != 7), stdout, "Error: mapread returned %d spans\n", numSpans);
+
+    // push a lot of other sectors through the cache, the views must not move
+    fd2 = sfs_fopen("big");
+    FAIL_BRK3((fd2 == -1), stdout, "Error: fopen for big failed\n");
+    for (i = 0; i < bigSize; i += SD_SECTORSIZE) {
+        FAIL_BRK3((sfs_fread(fd2, cpy, SD_SECTORSIZE) != SD_SECTORSIZE), stdout,
+                "Error: Read failed\n");
+        FAIL_BRK3(checkBuffers(big + i, cpy, SD_SECTORSIZE, 0), stdout,
+                "Error: Contents of big don't match\n");
+    }
+    FAIL_BRK3(sfs_fclose(fd2), stdout, "Error: Closing the file failed\n");
+
+    for (i = 0, got = 0; i < numSpans; got += spans[i].len, i++) {
+        memcpy(cpy + got, spans[i].base, spans[i].len);
+    }
+    FAIL_BRK3((got != fsize - 10), stdout, "Error: spans cover %d bytes\n", got);
+    FAIL_BRK3(checkBuffers(buffer + 10, cpy, fsize - 10, 0), stdout,
+            "Error: Contents of the spans don't match\n");
+    FAIL_BRK3(sfs_unmap(spans, numSpans), stdout, "Error: unmap failed\n");
+
+    // fewer spans than sectors
+    numSpans = sfs_mapread(fd, 0, fsize, spans, 2);
+    FAIL_BRK3((numSpans != 2 || spans[1].len != SD_SECTORSIZE), stdout,
+            "Error: mapread with 2 spans failed\n");
+    FAIL_BRK3(sfs_unmap(spans, numSpans), stdout, "Error: unmap failed\n");
+    FAIL_BRK3((sfs_mapread(fd, fsize, 10, spans, 16) != -1), stdout,
+            "Error: Allowing mapread pass the end of the file\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(big);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Map Read Test");
+    return hr;
+}
+
+/**
+ * Tests that streaming, seeking and interleaved readers still see the right data with readahead
+ */
+int readaheadTest() {
+    int hr = SUCCESS;
+    int i, fd, fd2, pos, len, fsize = 80 * SD_SECTORSIZE + 37, chunk = 100;
+    int window[5] = { 4, 8, 16, 32, 32 };
+    long long reads;
+    char *buffer = malloc(fsize);
+    char *cpy = malloc(fsize);
+    sfs_iovec_t iov[2];
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // the file has a hole in the middle that readahead has to skip over
+    fd = sfs_fopen("stream");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for stream failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer, 30 * SD_SECTORSIZE, 0) != 30 * SD_SECTORSIZE), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer + 40 * SD_SECTORSIZE, fsize - 40 * SD_SECTORSIZE,
+            40 * SD_SECTORSIZE) != fsize - 40 * SD_SECTORSIZE), stdout, "Error: Write failed\n");
+    memset(buffer + 30 * SD_SECTORSIZE, 0, 10 * SD_SECTORSIZE);
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+
+    // stream it in small reads
+    fd = sfs_fopen("stream");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening the file failed\n");
+    for (pos = 0; pos < fsize; pos += len) {
+        len = (fsize - pos < chunk) ? fsize - pos : chunk;
+        FAIL_BRK3((sfs_fread(fd, cpy + pos, chunk) != len), stdout,
+                "Error: Read at %d failed\n", pos);
+    }
+    FAIL_BRK3(checkBuffers(buffer, cpy, fsize, 0), stdout,
+            "Error: Contents of the stream don't match\n");
+
+    // seek around, and stream again from somewhere else
+    for (i = 0; i < 50; i++) {
+        pos = (i * 7919) % (fsize - chunk);
+        FAIL_BRK3((sfs_lseek(fd, pos) == -1), stdout, "Error: Seeking failed\n");
+        FAIL_BRK3((sfs_fread(fd, cpy, chunk) != chunk), stdout,
+                "Error: Read at %d failed\n", pos);
+        FAIL_BRK3(checkBuffers(buffer + pos, cpy, chunk, 0), stdout,
+                "Error: Contents at %d don't match\n", pos);
+    }
+
+    // two readers of one file, each streaming with readv
+    fd2 = sfs_fopen("stream");
+    FAIL_BRK3((fd2 == -1), stdout, "Error: fopen for the second reader failed\n");
+    FAIL_BRK3((sfs_lseek(fd, 0) == -1), stdout, "Error: Seeking failed\n");
+    FAIL_BRK3((sfs_lseek(fd2, fsize / 2) == -1), stdout, "Error: Seeking failed\n");
+    for (pos = 0; pos + 2 * chunk <= fsize / 2; pos += 2 * chunk) {
+        iov[0].base = cpy + pos;
+        iov[0].len = chunk;
+        iov[1].base = cpy + pos + chunk;
+        iov[1].len = chunk;
+        FAIL_BRK3((sfs_readv(fd, iov, 2) != 2 * chunk), stdout, "Error: readv failed\n");
+        iov[0].base = cpy + fsize / 2 + pos;
+        iov[1].base = cpy + fsize / 2 + pos + chunk;
+        FAIL_BRK3((sfs_readv(fd2, iov, 2) != 2 * chunk), stdout, "Error: readv failed\n");
+    }
+    FAIL_BRK3(checkBuffers(buffer, cpy, pos, 0), stdout,
+            "Error: Contents of the first reader don't match\n");
+    FAIL_BRK3(checkBuffers(buffer + fsize / 2, cpy + fsize / 2, pos, 0), stdout,
+            "Error: Contents of the second reader don't match\n");
+    FAIL_BRK3(sfs_fclose(fd2), stdout, "Error: Closing the file failed\n");
+
+    // what is prefetched must not hide a later write
+    FAIL_BRK3((sfs_lseek(fd, 0) == -1), stdout, "Error: Seeking failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, chunk) != chunk), stdout, "Error: Read failed\n");
+    initBuffer(buffer, 20 * SD_SECTORSIZE);
+    FAIL_BRK3((sfs_pwrite(fd, buffer, 20 * SD_SECTORSIZE, 0) != 20 * SD_SECTORSIZE), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, 10 * SD_SECTORSIZE) != 10 * SD_SECTORSIZE), stdout,
+            "Error: Read failed\n");
+    FAIL_BRK3(checkBuffers(buffer + chunk, cpy, 10 * SD_SECTORSIZE, 0), stdout,
+            "Error: Read after write doesn't match\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    // from a cold cache, read sector by sector and count what comes off the disk: a read
+    // reaches window sectors past itself, the window doubles from 4 up to 32, and a seek
+    // stops prefetching until the reads are sequential again
+    fd = sfs_fopen("seq");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for seq failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 64 * SD_SECTORSIZE) != 64 * SD_SECTORSIZE), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    fd = sfs_fopen("seq");
+    FAIL_BRK3((fd == -1), stdout, "Error: reopening seq failed\n");
+    reads = SD_numReads();
+    for (i = 0; i < 5; i++) {
+        FAIL_BRK3((sfs_fread(fd, cpy, SD_SECTORSIZE) != SD_SECTORSIZE), stdout,
+                "Error: Read of sector %d failed\n", i);
+        FAIL_BRK3((SD_numReads() - reads != i + 1 + window[i]), stdout,
+                "Error: After sector %d, %lld sectors were read instead of %d\n", i,
+                SD_numReads() - reads, i + 1 + window[i]);
+    }
+    FAIL_BRK3((sfs_lseek(fd, 50 * SD_SECTORSIZE) == -1), stdout, "Error: Seeking failed\n");
+    reads = SD_numReads();
+    FAIL_BRK3((sfs_fread(fd, cpy, SD_SECTORSIZE) != SD_SECTORSIZE), stdout, "Error: Read failed\n");
+    FAIL_BRK3((SD_numReads() - reads != 1), stdout,
+            "Error: A read right after a seek prefetched %lld sectors\n", SD_numReads() - reads - 1);
+    FAIL_BRK3((sfs_fread(fd, cpy, SD_SECTORSIZE) != SD_SECTORSIZE), stdout, "Error: Read failed\n");
+    FAIL_BRK3((SD_numReads() - reads != 2 + 4), stdout,
+            "Error: The window didn't start over at 4 after a seek\n");
+    FAIL_BRK3(checkBuffers(buffer + 51 * SD_SECTORSIZE, cpy, SD_SECTORSIZE, 0), stdout,
+            "Error: Contents after the seek don't match\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Readahead Test");
+    return hr;
+}
+
+/**
+ * Tests that small writes buffered per descriptor reach the disk in contiguous runs and are seen by everyone
+ */
+int writeBufferTest() {
+    int hr = SUCCESS;
+    int i, fd, fd2, fd3, chunk = 37, fsize = 200 * 37;
+    char *buffer = malloc(fsize);
+    char *other = malloc(fsize);
+    char *cpy = malloc(fsize);
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+    initBuffer(other, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // two files appended to in turns, each should still get runs of sectors
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    fd2 = sfs_fopen("bar");
+    FAIL_BRK3((fd2 == -1), stdout, "Error: fopen for bar failed\n");
+    for (i = 0; i < fsize; i += chunk) {
+        FAIL_BRK3((sfs_fwrite(fd, buffer + i, chunk) != chunk), stdout,
+                "Error: Write to foo failed\n");
+        FAIL_BRK3((sfs_fwrite(fd2, other + i, chunk) != chunk), stdout,
+                "Error: Write to bar failed\n");
+    }
+    FAIL_BRK3(sfs_fsync(fd), stdout, "Error: fsync failed\n");
+    FAIL_BRK3(sfs_fstat(fd, &st), stdout, "Error: fstat failed\n");
+    FAIL_BRK3((st.size != fsize || st.numextent > 3), stdout,
+            "Error: foo has size %d in %d extents\n", st.size, st.numextent);
+
+    // another descriptor sees what is still buffered in bar
+    fd3 = sfs_fopen("bar");
+    FAIL_BRK3((fd3 == -1), stdout, "Error: fopen for bar failed\n");
+    FAIL_BRK3((sfs_fread(fd3, cpy, fsize) != fsize), stdout, "Error: Read failed\n");
+    FAIL_BRK3(checkBuffers(other, cpy, fsize, 0), stdout,
+            "Error: Contents of bar don't match\n");
+
+    // overwriting what is buffered, then reading it back through the same descriptor
+    FAIL_BRK3((sfs_lseek(fd, 10) == -1), stdout, "Error: Seeking failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, other, chunk) != chunk), stdout, "Error: Write failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, other, chunk) != chunk), stdout, "Error: Write failed\n");
+    memcpy(buffer + 10, other, chunk);
+    memcpy(buffer + 10 + chunk, other, chunk);
+    FAIL_BRK3((sfs_pread(fd, cpy, fsize, 0) != fsize), stdout, "Error: Read failed\n");
+    FAIL_BRK3(checkBuffers(buffer, cpy, fsize, 0), stdout,
+            "Error: Contents of foo don't match\n");
+
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_fclose(fd2), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_fclose(fd3), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK4(verifyFile("foo", buffer, fsize));
+    FAIL_BRK4(verifyFile("bar", other, fsize));
+
+    // buffered data of a removed file goes away with it
+    fd = sfs_fopen("gone");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for gone failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, chunk) != chunk), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_rm("gone"), stdout, "Error: deleting file failed\n");
+    FAIL_BRK3(sfs_stat("gone", &st) != -1, stdout, "Error: gone is still there\n");
+    FAIL_BRK3((sfs_fsync(fd) != 0), stdout, "Error: fsync after rm failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3((sfs_fsync(fd) != -1), stdout, "Error: Allowing fsync of a closed file\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(other);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Write Buffer Test");
+    return hr;
+}
+
+/**
+ * Tests that what sfs_fsync and sfs_sync made durable is found again by sfs_mount
+ */
+int syncTest() {
+    int hr = SUCCESS;
+    int i, fd, chunk = 50, fsize = 20 * 50, bigSize = 30 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *big = malloc(bigSize);
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+    initBuffer(big, bigSize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // small writes made durable through the descriptor, which mount then forgets
+    fd = sfs_fopen("kept");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for kept failed\n");
+    for (i = 0; i < fsize; i += chunk) {
+        FAIL_BRK3((sfs_fwrite(fd, buffer + i, chunk) != chunk), stdout,
+                "Error: Write failed\n");
+    }
+    FAIL_BRK3(sfs_fsync(fd), stdout, "Error: fsync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_fread(fd, buffer, chunk) != -1), stdout,
+            "Error: A descriptor survived the mount\n");
+    FAIL_BRK4(verifyFile("kept", buffer, fsize));
+
+    // a folder, a file in it and a truncate, all made durable at once
+    FAIL_BRK4(createFolder("dir"));
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK4(createSmallFile("inner", big, bigSize));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3(sfs_truncate("kept", 10), stdout, "Error: truncate failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3(sfs_stat("kept", &st), stdout, "Error: stat of kept failed\n");
+    FAIL_BRK3((st.size != 10), stdout, "Error: kept has size %d after mount\n", st.size);
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir after mount failed\n");
+    FAIL_BRK4(verifyFile("inner", big, bigSize));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+
+    // data still waiting in a buffer is not on the disk
+    fd = sfs_fopen("late");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for late failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, chunk) != chunk), stdout, "Error: Write failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_stat("late", &st) == 0 && st.size != 0), stdout,
+            "Error: late has size %d without a sync\n", st.size);
+    FAIL_BRK3((sfs_fsync(fd) != -1), stdout, "Error: Allowing fsync after mount\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(big);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Sync Test");
+    return hr;
+}
+
+/**
+ * Tests that after a crash mount finds whole journal groups only, in the order they were made
+ */
+int journalTest() {
+    int hr = SUCCESS;
+    int i, fd, dd, found, numFiles = 150, fsize = 100;
+    char fileName[16];
+    char *buffer = malloc(fsize);
+    sfs_dirent_t entry;
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // many small operations and no sync, then the machine goes down
+    for (i = 0; i < numFiles; i++) {
+        sprintf(fileName, "file%04d", i);
+        FAIL_BRK4(createSmallFile(fileName, buffer, fsize));
+    }
+    FAIL_BRK4(createFolder("last"));
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+
+    // what survived is the files created first, and nothing half made
+    dd = sfs_opendir("/");
+    FAIL_BRK3((dd == -1), stdout, "Error: opendir failed\n");
+    for (found = 0; sfs_readdir(dd, &entry) == 1;) {
+        if (entry.name[0] == '.')
+            continue;
+        if (!strcmp(entry.name, "last"))
+            continue;
+        sprintf(fileName, "file%04d", found);
+        FAIL_BRK3(strcmp(entry.name, fileName), stdout,
+                "Error: found %s where %s should be\n", entry.name, fileName);
+        FAIL_BRK3((entry.type != 2 || (entry.size != 0 && entry.size != fsize)), stdout,
+                "Error: %s has type %d and size %d\n", entry.name, entry.type, entry.size);
+        found++;
+    }
+    FAIL_BRK3(sfs_closedir(dd), stdout, "Error: closedir failed\n");
+    FAIL_BRK3((found == 0 || found > numFiles), stdout,
+            "Error: %d files survived\n", found);
+    FAIL_BRK3((sfs_stat("last", &st) == 0 && found != numFiles), stdout,
+            "Error: the last folder survived without the files before it\n");
+
+    // the same again, made durable
+    for (i = 0; i < numFiles; i++) {
+        sprintf(fileName, "file%04d", i);
+        FAIL_BRK4(createSmallFile(fileName, buffer, fsize));
+    }
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    for (i = 0; i < numFiles; i++) {
+        sprintf(fileName, "file%04d", i);
+        FAIL_BRK4(verifyFile(fileName, buffer, fsize));
+    }
+
+    // a mount with nothing to replay changes nothing
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("file0000", buffer, fsize));
+
+    // a mkdir or a create that fails on a full disk leaves nothing half made for the next commit
+    FAIL_BRK4(createFolder("full"));
+    FAIL_BRK3(sfs_fcd("full"), stdout, "Error: cd to full failed\n");
+    for (i = 0; i < 17; i++) { // one free entry left once fill is there
+        sprintf(fileName, "f%02d", i);
+        FAIL_BRK4(createSmallFile(fileName, buffer, 10));
+    }
+    fd = sfs_fopen("fill");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for fill failed\n");
+    while (sfs_fwrite(fd, buffer, fsize) == fsize);
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n"); // what was freed meanwhile is free now
+    while (sfs_fwrite(fd, buffer, 1) == 1);
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3((sfs_mkdir("nodir") != -1), stdout, "Error: mkdir worked on a full disk\n");
+    FAIL_BRK3((sfs_stat("nodir", &st) != -1), stdout, "Error: nodir is there after a failed mkdir\n");
+    FAIL_BRK4(createSmallFile("pad", buffer, 10)); // kept inside its inode, the dir is full now
+    FAIL_BRK3((sfs_fopen("nofile") != -1), stdout, "Error: Creating a file in a full dir on a full disk\n");
+    FAIL_BRK3((sfs_stat("nofile", &st) != -1), stdout, "Error: nofile is there after a failed create\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems after the failures\n");
+    FAIL_BRK3(sfs_fcd("full"), stdout, "Error: cd to full failed\n");
+    FAIL_BRK3(sfs_rm("fill"), stdout, "Error: deleting fill failed\n");
+    FAIL_BRK4(createFolder("nodir"));
+    FAIL_BRK4(createSmallFile("nofile", buffer, fsize));
+    FAIL_BRK4(verifyFile("nofile", buffer, fsize));
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Journal Test");
+    return hr;
+}
+
+/**
+ * Tests that sfs_fsck finds nothing wrong after all kinds of operations, with any number of threads
+ */
+int fsckTest() {
+    int hr = SUCCESS;
+    int i, fd, fsize = 20 * SD_SECTORSIZE;
+    char fileName[16], one[128], many[128];
+    char *buffer = malloc(fsize);
+    FILE *f1 = tmpfile(), *f4 = tmpfile();
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // files of every shape, folders, and some of them removed or cut
+    FAIL_BRK4(createFolder("dir"));
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    for (i = 0; i < 30; i++) {
+        sprintf(fileName, "file%04d", i);
+        FAIL_BRK4(createSmallFile(fileName, buffer, (i * 997) % fsize + 1));
+    }
+    FAIL_BRK4(createFolder("sub"));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    fd = sfs_fopen("sparse");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for sparse failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer, 100, 40 * SD_SECTORSIZE) != 100), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3(sfs_fallocate(fd, 0, 3 * SD_SECTORSIZE), stdout, "Error: fallocate failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    for (i = 0; i < 30; i += 3) {
+        sprintf(fileName, "file%04d", i);
+        FAIL_BRK3(sfs_rm(fileName), stdout, "Error: deleting %s failed\n", fileName);
+    }
+    FAIL_BRK3(sfs_truncate("file0001", 10), stdout, "Error: truncate failed\n");
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+
+    // the same findings with one thread and with four
+    FAIL_BRK3((f1 == NULL || f4 == NULL), stdout, "Error: tmpfile failed\n");
+    FAIL_BRK3((sfs_fsck(f1, 1) != 0), stdout, "Error: fsck found problems\n");
+    FAIL_BRK3((sfs_fsck(f4, 4) != 0), stdout, "Error: fsck with 4 threads found problems\n");
+    rewind(f1);
+    rewind(f4);
+    FAIL_BRK3((fgets(one, sizeof(one), f1) == NULL || fgets(many, sizeof(many), f4) == NULL), stdout,
+            "Error: fsck reported nothing\n");
+    FAIL_BRK3((strncmp(one, many, strstr(one, "threads=") - one)), stdout,
+            "Error: fsck reports differ: %s and %s", one, many);
+
+    // and the same for what is on the disk
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_fsck(f1, 2) != 0), stdout, "Error: fsck after mount found problems\n");
+    FAIL_BRK3((sfs_fsck(NULL, 2) != -1), stdout, "Error: Allowing fsck without a stream\n");
+
+    Fail:
+
+    if (f1 != NULL)
+        fclose(f1);
+    if (f4 != NULL)
+        fclose(f4);
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Fsck Test");
+    return hr;
+}
+
+int checksumTest() {
+    int hr = SUCCESS;
+    int i, fd = -1, found = -1, fsize = 4 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *cpy = malloc(fsize);
+    char sector[SD_SECTORSIZE], line[128], other[128], expected[32], fileName[16];
+    sfs_stat_t st;
+    FILE *f = tmpfile(), *f4 = tmpfile();
+    initBuffer(buffer, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // clean data reads back through its checksums, before and after mount
+    FAIL_BRK4(createSmallFile("foo", buffer, fsize));
+    FAIL_BRK4(createFolder("dir"));
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("foo", buffer, fsize));
+
+    // flip one bit of the third sector of foo behind the filesystem's back
+    for (i = 0; i < SD_NUMSECTORS && found == -1; i++) {
+        FAIL_BRK3(SD_read(i, sector), stdout, "Error: SD_read failed\n");
+        if (memcmp(sector, buffer + 2 * SD_SECTORSIZE, SD_SECTORSIZE) == 0)
+            found = i;
+    }
+    FAIL_BRK3((found == -1), stdout, "Error: The sector of foo is not on the disk\n");
+    sector[7] ^= 0x10;
+    FAIL_BRK3(SD_write(found, sector), stdout, "Error: SD_write failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+
+    // only that sector fails to read
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    FAIL_BRK3((sfs_pread(fd, cpy, SD_SECTORSIZE, 2 * SD_SECTORSIZE) != -1), stdout,
+            "Error: Read a corrupt sector\n");
+    FAIL_BRK3((sfs_pread(fd, cpy, fsize, 0) != -1), stdout,
+            "Error: Read across a corrupt sector\n");
+    FAIL_BRK3((sfs_pread(fd, cpy, 2 * SD_SECTORSIZE, 0) != 2 * SD_SECTORSIZE), stdout,
+            "Error: Read failed next to a corrupt sector\n");
+    FAIL_BRK3(checkBuffers(buffer, cpy, 2 * SD_SECTORSIZE, 0), stdout,
+            "Error: Contents of foo don't match\n");
+
+    // fsck finds it, and nothing else
+    FAIL_BRK3((f == NULL), stdout, "Error: tmpfile failed\n");
+    FAIL_BRK3((sfs_fsck(f, 2) != 1), stdout, "Error: fsck didn't find just the corrupt sector\n");
+    rewind(f);
+    sprintf(expected, "badcsum sector=%d ", found);
+    FAIL_BRK3((fgets(line, sizeof(line), f) == NULL || strncmp(line, expected, strlen(expected))), stdout,
+            "Error: fsck reported %s", line);
+
+    // writing the whole sector again mends it
+    FAIL_BRK3((sfs_pwrite(fd, buffer + 2 * SD_SECTORSIZE, SD_SECTORSIZE, 2 * SD_SECTORSIZE) != SD_SECTORSIZE),
+            stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK4(verifyFile("foo", buffer, fsize));
+    FAIL_BRK3((sfs_fsck(f, 2) != 0), stdout, "Error: fsck found problems after the rewrite\n");
+
+    // a corrupt header is refused by mount
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(SD_read(1, sector), stdout, "Error: SD_read failed\n");
+    sector[100] ^= 1;
+    FAIL_BRK3(SD_write(1, sector), stdout, "Error: SD_write failed\n");
+    FAIL_BRK3((sfs_mount() != -1), stdout, "Error: Mounted a corrupt header\n");
+    sector[100] ^= 1;
+    FAIL_BRK3(SD_write(1, sector), stdout, "Error: SD_write failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("foo", buffer, fsize));
+
+    // a bad sector two files share is blamed on the lower inode, however the threads ran
+    for (i = 0; i < 80; i++) {
+        sprintf(fileName, "pad%02d", i);
+        FAIL_BRK4(createSmallFile(fileName, buffer, 10));
+    }
+    FAIL_BRK3(sfs_clone("foo", "bar"), stdout, "Error: clone failed\n");
+    FAIL_BRK3(sfs_stat("foo", &st), stdout, "Error: stat failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(SD_read(found, sector), stdout, "Error: SD_read failed\n");
+    sector[7] ^= 0x10;
+    FAIL_BRK3(SD_write(found, sector), stdout, "Error: SD_write failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((f4 == NULL), stdout, "Error: tmpfile failed\n");
+    rewind(f);
+    FAIL_BRK3((sfs_fsck(f, 1) != 1), stdout, "Error: fsck didn't find just the shared corrupt sector\n");
+    FAIL_BRK3((sfs_fsck(f4, 4) != 1), stdout, "Error: fsck with 4 threads didn't find just the shared corrupt sector\n");
+    rewind(f);
+    rewind(f4);
+    sprintf(expected, "badcsum sector=%d inode=%d\n", found, st.inode);
+    FAIL_BRK3((fgets(line, sizeof(line), f) == NULL || strcmp(line, expected)), stdout,
+            "Error: fsck reported %s", line);
+    FAIL_BRK3((fgets(other, sizeof(other), f4) == NULL || strcmp(other, expected)), stdout,
+            "Error: fsck with 4 threads reported %s", other);
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    if (f != NULL)
+        fclose(f);
+    if (f4 != NULL)
+        fclose(f4);
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Checksum Test");
+    return hr;
+}
+
+/**
+ * Tests that data rewritten after the last commit still matches its checksum after a crash
+ */
+int checksumCrashTest() {
+    int hr = SUCCESS;
+    int i, fd = -1, fsize = 8 * SD_SECTORSIZE;
+    char *a = malloc(fsize);
+    char *b = malloc(fsize);
+    char *cpy = malloc(fsize);
+    sfs_stat_t st;
+    FILE *f = tmpfile();
+    memset(a, 'A', fsize);
+    memset(b, 'B', fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+
+    // foo and bar are on the disk with their checksums
+    FAIL_BRK4(createSmallFile("foo", a, fsize));
+    FAIL_BRK4(createSmallFile("bar", a, fsize));
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+
+    // rewrite all of foo and part of a sector, drop bar and fill its sectors again, then the machine goes down
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, b, fsize) != fsize), stdout, "Error: Write failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, b, 100, 3 * SD_SECTORSIZE + 10) != 100), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3(sfs_rm("bar"), stdout, "Error: deleting bar failed\n");
+    FAIL_BRK4(createSmallFile("baz", b, 4 * fsize));
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+
+    // every sector reads back, old or new, and its checksum agrees
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    FAIL_BRK3((sfs_fread(fd, cpy, fsize) != fsize), stdout, "Error: Read of foo failed after the crash\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    for (i = 0; i < fsize; i += SD_SECTORSIZE) {
+        FAIL_BRK3((memcmp(cpy + i, a, SD_SECTORSIZE) && memcmp(cpy + i, b, SD_SECTORSIZE)), stdout,
+                "Error: Sector %d of foo is neither the old nor the new data\n", i / SD_SECTORSIZE);
+    }
+    if (sfs_stat("bar", &st) == 0)
+        FAIL_BRK4(verifyFile("bar", a, fsize));
+    FAIL_BRK3((f == NULL), stdout, "Error: tmpfile failed\n");
+    FAIL_BRK3((sfs_fsck(f, 2) != 0), stdout, "Error: fsck found problems after the crash\n");
+
+    // once committed, the new data is what survives
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, b, fsize) != fsize), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("foo", b, fsize));
+    FAIL_BRK3((sfs_fsck(f, 2) != 0), stdout, "Error: fsck found problems after the sync\n");
+
+    // data is rewritten where it is, so small synced appends keep a reservation in one run
+    fd = sfs_fopen("log");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for log failed\n");
+    FAIL_BRK3(sfs_fallocate(fd, 0, 10 * SD_SECTORSIZE), stdout, "Error: fallocate failed\n");
+    for (i = 0; i < 100; i++) {
+        FAIL_BRK3((sfs_pwrite(fd, b, 40, 40 * i) != 40), stdout, "Error: Append %d failed\n", i);
+        FAIL_BRK3(sfs_fsync(fd), stdout, "Error: fsync failed\n");
+    }
+    FAIL_BRK3(sfs_fstat(fd, &st), stdout, "Error: fstat failed\n");
+    FAIL_BRK3((st.numsector != 10 || st.numextent != 1), stdout,
+            "Error: The appends left %d sectors in %d runs\n", st.numsector, st.numextent);
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+
+    // sectors freed since the last commit are still there for a full disk
+    FAIL_BRK4(createSmallFile("five", a, 5 * SD_SECTORSIZE));
+    fd = sfs_fopen("fill");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for fill failed\n");
+    while (sfs_fwrite(fd, a, fsize) == fsize);
+    while (sfs_fwrite(fd, a, SD_SECTORSIZE) == SD_SECTORSIZE);
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(sfs_rm("five"), stdout, "Error: deleting five failed\n");
+    FAIL_BRK4(createSmallFile("again", b, 5 * SD_SECTORSIZE));
+    FAIL_BRK4(verifyFile("again", b, 5 * SD_SECTORSIZE));
+    FAIL_BRK3((sfs_fsck(f, 2) != 0), stdout, "Error: fsck found problems on the full disk\n");
 
     Fail:
 
+    if (fd != -1)
+        sfs_fclose(fd);
+    if (f != NULL)
+        fclose(f);
+    SAFE_FREE(a);
+    SAFE_FREE(b);
+    SAFE_FREE(cpy);
     saveAndCloseDisk();
-    PRINT_RESULTS("Error Test");
+    PRINT_RESULTS("Checksum Crash Test");
+    return hr;
+}
+
+int crcTest() {
+    int hr = SUCCESS;
+    int i, j, k, reps = 64, size = 1 << 20;
+    int lengths[] = { 0, 1, 7, 8, 9, 63, 503, 504, 505, 512, 1000, 1513, 4000 };
+    char *buffer = malloc(size + 8);
+    char *cpy = malloc(size);
+    unsigned int crc = 0;
+    double crcTime, copyTime;
+    struct timeval start, end;
+    initBuffer(buffer, size + 8);
+
+    // the check values of the iSCSI spec
+    FAIL_BRK3((sfs_crc32c(0, "123456789", 9) != 0xe3069283), stdout,
+            "Error: crc32c of 123456789 is wrong\n");
+    memset(cpy, 0, 32);
+    FAIL_BRK3((sfs_crc32c(0, cpy, 32) != 0x8a9136aa), stdout, "Error: crc32c of zeros is wrong\n");
+    memset(cpy, 0xff, 32);
+    FAIL_BRK3((sfs_crc32c(0, cpy, 32) != 0x62a8ab43), stdout, "Error: crc32c of ones is wrong\n");
+
+    // every length and alignment against a plain bitwise CRC, whole and in two pieces
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        for (j = 0; j < 8; j++) {
+            crc = crc32cBitwise((unsigned char *) buffer + j, lengths[i]);
+            FAIL_BRK3((sfs_crc32c(0, buffer + j, lengths[i]) != crc), stdout,
+                    "Error: crc32c of %d bytes at offset %d is wrong\n", lengths[i], j);
+            k = lengths[i] / 3;
+            FAIL_BRK3((sfs_crc32c(sfs_crc32c(0, buffer + j, k), buffer + j + k, lengths[i] - k) != crc),
+                    stdout, "Error: crc32c of %d bytes in two pieces is wrong\n", lengths[i]);
+        }
+    }
+
+    // what a checksum costs next to copying the sector
+    gettimeofday(&start, NULL);
+    for (i = 0; i < reps; i++)
+        for (j = 0; j < size; j += SD_SECTORSIZE)
+            crc ^= sfs_crc32c(0, buffer + j, SD_SECTORSIZE);
+    gettimeofday(&end, NULL);
+    crcTime = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < reps; i++)
+        for (j = 0; j < size; j += SD_SECTORSIZE)
+            memcpy(cpy + j, buffer + j + (i & 7), SD_SECTORSIZE);
+    gettimeofday(&end, NULL);
+    copyTime = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    printf("crc32c %.0f MB/s, memcpy %.0f MB/s per sector (%08x %d)\n",
+            reps / (crcTime > 0 ? crcTime : 1e-6), reps / (copyTime > 0 ? copyTime : 1e-6), crc, cpy[reps]);
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(cpy);
+    PRINT_RESULTS("CRC Test");
+    return hr;
+}
+
+int incrementalSaveTest() {
+    int hr = SUCCESS;
+    int fd = -1, numDirty, fsize = 3 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char sector[SD_SECTORSIZE], mark[SD_SECTORSIZE], fullName[256];
+    FILE *f = NULL;
+    struct stat st;
+    initBuffer(buffer, fsize);
+    initBuffer(mark, SD_SECTORSIZE);
+    snprintf(fullName, sizeof(fullName), "%s.full", gsDiskFName);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createSmallFile("foo", buffer, fsize));
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(SD_saveDiskIncremental(gsDiskFName), stdout,
+            "Error %d while saving disk image to %s\n", sderrno, gsDiskFName);
+    FAIL_BRK3((SD_numDirty() != 0), stdout, "Error: Sectors are dirty right after a save\n");
+
+    // change a sector of the file behind the disk's back, the next save must leave it alone
+    f = fopen(gsDiskFName, "r+");
+    FAIL_BRK3((f == NULL), stdout, "Error: Opening %s failed\n", gsDiskFName);
+    FAIL_BRK3((fseek(f, (long) (SD_NUMSECTORS - 1) * SD_SECTORSIZE, SEEK_SET) != 0
+            || fwrite(mark, SD_SECTORSIZE, 1, f) != 1), stdout, "Error: Writing %s failed\n", gsDiskFName);
+    fclose(f);
+    f = NULL;
+
+    // a small change dirties a handful of sectors, and only those are saved
+    fd = sfs_fopen("foo");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for foo failed\n");
+    memset(buffer + 600, 'x', 10);
+    FAIL_BRK3((sfs_pwrite(fd, buffer + 600, 10, 600) != 10), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fsync(fd), stdout, "Error: fsync failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    numDirty = SD_numDirty();
+    FAIL_BRK3((numDirty == 0 || numDirty > 16), stdout,
+            "Error: %d sectors are dirty after a small write\n", numDirty);
+    FAIL_BRK3(SD_saveDiskIncremental(gsDiskFName), stdout,
+            "Error %d while saving disk image to %s\n", sderrno, gsDiskFName);
+    FAIL_BRK3(SD_loadDisk(gsDiskFName), stdout,
+            "Error %d while reading disk image from %s\n", sderrno, gsDiskFName);
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("foo", buffer, fsize));
+    FAIL_BRK3(SD_read(SD_NUMSECTORS - 1, sector), stdout, "Error: SD_read failed\n");
+    FAIL_BRK3(memcmp(sector, mark, SD_SECTORSIZE), stdout,
+            "Error: An incremental save rewrote a clean sector\n");
+
+    // any other file gets the whole image
+    FAIL_BRK3(SD_saveDiskIncremental(fullName), stdout,
+            "Error %d while saving disk image to %s\n", sderrno, fullName);
+    FAIL_BRK3((stat(fullName, &st) != 0 || st.st_size != (off_t) SD_NUMSECTORS * SD_SECTORSIZE), stdout,
+            "Error: %s is not a whole image\n", fullName);
+    FAIL_BRK3((SD_numDirty() != 0), stdout, "Error: Sectors are dirty right after a save\n");
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    if (f != NULL)
+        fclose(f);
+    remove(fullName);
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Incremental Save Test");
+    return hr;
+}
+
+int compressedImageTest() {
+    int hr = SUCCESS;
+    int i, fsize = 40 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *text = malloc(fsize);
+    char *image = malloc(SD_NUMSECTORS * SD_SECTORSIZE);
+    char sector[SD_SECTORSIZE], zName[256];
+    const char *line = "the quick brown fox jumps over the lazy dog\n";
+    struct stat st;
+    initBuffer(buffer, fsize);
+    for (i = 0; i < fsize; i++)
+        text[i] = line[i % strlen(line)];
+    snprintf(zName, sizeof(zName), "%s.z", gsDiskFName);
+
+    // a disk of junk comes back exactly, its chunks stored rather than compressed
+    FAIL_BRK3(SD_initDisk(), stdout, "Error %d while SD_initDisk()\n", sderrno);
+    for (i = 0; i < SD_NUMSECTORS; i++) {
+        initBuffer(image + i * SD_SECTORSIZE, SD_SECTORSIZE);
+        FAIL_BRK3(SD_write(i, image + i * SD_SECTORSIZE), stdout, "Error: SD_write failed\n");
+    }
+    FAIL_BRK3(SD_saveDiskCompressed(zName), stdout,
+            "Error %d while saving disk image to %s\n", sderrno, zName);
+    FAIL_BRK3(SD_write(7, buffer), stdout, "Error: SD_write failed\n");
+    FAIL_BRK3(SD_loadDisk(zName), stdout,
+            "Error %d while reading disk image from %s\n", sderrno, zName);
+    for (i = 0; i < SD_NUMSECTORS; i++) {
+        FAIL_BRK3(SD_read(i, sector), stdout, "Error: SD_read failed\n");
+        FAIL_BRK3(checkBuffers(image + i * SD_SECTORSIZE, sector, SD_SECTORSIZE, 0), stdout,
+                "Error: Sector %d of the junk image doesn't match\n", i);
+    }
+
+    // a filesystem on a clean disk takes little more room than its random data
+    FAIL_BRK3(SD_finalizeDisk(), stdout, "Error %d while during SD_finalizeDisk()\n", sderrno);
+    FAIL_BRK3(SD_initDisk(), stdout, "Error %d while SD_initDisk()\n", sderrno);
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createSmallFile("random", buffer, fsize));
+    FAIL_BRK4(createSmallFile("text", text, fsize));
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    for (i = 0; i < SD_NUMSECTORS; i++)
+        FAIL_BRK3(SD_read(i, image + i * SD_SECTORSIZE), stdout, "Error: SD_read failed\n");
+    FAIL_BRK3(SD_saveDiskCompressed(zName), stdout,
+            "Error %d while saving disk image to %s\n", sderrno, zName);
+    FAIL_BRK3((stat(zName, &st) != 0 || st.st_size > fsize + 12 * SD_SECTORSIZE), stdout,
+            "Error: The image of a nearly empty disk takes %ld bytes\n", (long) st.st_size);
+
+    // zero sectors come back zero over whatever was there, and the filesystem mounts
+    for (i = 0; i < SD_NUMSECTORS; i++)
+        FAIL_BRK3(SD_write(i, buffer + (i % 40) * SD_SECTORSIZE), stdout, "Error: SD_write failed\n");
+    FAIL_BRK3(SD_loadDisk(zName), stdout,
+            "Error %d while reading disk image from %s\n", sderrno, zName);
+    for (i = 0; i < SD_NUMSECTORS; i++) {
+        FAIL_BRK3(SD_read(i, sector), stdout, "Error: SD_read failed\n");
+        FAIL_BRK3(checkBuffers(image + i * SD_SECTORSIZE, sector, SD_SECTORSIZE, 0), stdout,
+                "Error: Sector %d of the filesystem image doesn't match\n", i);
+    }
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("random", buffer, fsize));
+    FAIL_BRK4(verifyFile("text", text, fsize));
+
+    // an incremental save keeps the format
+    FAIL_BRK4(createSmallFile("more", text, 100));
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(SD_saveDiskIncremental(zName), stdout,
+            "Error %d while saving disk image to %s\n", sderrno, zName);
+    FAIL_BRK3((stat(zName, &st) != 0 || st.st_size >= SD_NUMSECTORS * SD_SECTORSIZE), stdout,
+            "Error: The incremental save wasn't sparse\n");
+    FAIL_BRK3(SD_loadDisk(zName), stdout,
+            "Error %d while reading disk image from %s\n", sderrno, zName);
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("more", text, 100));
+
+    Fail:
+
+    remove(zName);
+    SAFE_FREE(buffer);
+    SAFE_FREE(text);
+    SAFE_FREE(image);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Compressed Image Test");
+    return hr;
+}
+
+int snapshotTest() {
+    int hr = SUCCESS;
+    int i, fd = -1, fsize = 3 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *later = malloc(fsize);
+    char name[16];
+    sfs_stat_t st;
+    FILE *f = tmpfile();
+    initBuffer(buffer, fsize);
+    initBuffer(later, fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createSmallFile("a", buffer, fsize));
+    FAIL_BRK4(createSmallFile("b", buffer, 20));
+    FAIL_BRK4(createFolder("dir"));
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK4(createSmallFile("c", buffer, 2 * SD_SECTORSIZE));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+
+    FAIL_BRK3(sfs_snapshot("s1"), stdout, "Error: snapshot failed\n");
+    FAIL_BRK3((sfs_snapshot("s1") != -1), stdout, "Error: Allowing two snapshots with one name\n");
+    FAIL_BRK3((sfs_snapshot("a name too long for it") != -1), stdout,
+            "Error: Allowing a snapshot name that doesn't fit\n");
+
+    // change everything the snapshot shares
+    fd = sfs_fopen("a");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for a failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, later + 100, 700, 100) != 700), stdout, "Error: Write failed\n");
+    memcpy(later, buffer, 100);
+    memcpy(later + 800, buffer + 800, fsize - 800);
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3(sfs_rm("b"), stdout, "Error: deleting b failed\n");
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK3(sfs_truncate("c", 10), stdout, "Error: truncate failed\n");
+    FAIL_BRK4(createFolder("e"));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK4(createSmallFile("d", later, fsize));
+    FAIL_BRK3((f == NULL), stdout, "Error: tmpfile failed\n");
+    FAIL_BRK3((sfs_fsck(f, 2) != 0), stdout, "Error: fsck found problems with a snapshot kept\n");
+
+    // the snapshot still sees the filesystem as it was, and can't change it
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(refreshDisk(), stdout, "Error: Refresh disk failed\n");
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3(sfs_snapmount("s1"), stdout, "Error: mounting the snapshot failed\n");
+    FAIL_BRK4(verifyFile("b", buffer, 20));
+    FAIL_BRK3((sfs_stat("a", &st) || st.size != fsize), stdout, "Error: a changed in the snapshot\n");
+    FAIL_BRK4(verifyFile("a", buffer, fsize));
+    FAIL_BRK3((sfs_stat("d", &st) != -1), stdout, "Error: d is in the snapshot\n");
+    FAIL_BRK3((sfs_fopen("d") != -1), stdout, "Error: Creating a file in a snapshot\n");
+    FAIL_BRK3((sfs_mkdir("f") != -1), stdout, "Error: Creating a folder in a snapshot\n");
+    FAIL_BRK3((sfs_rm("a") != -1), stdout, "Error: Deleting a file in a snapshot\n");
+    FAIL_BRK3((sfs_snapshot("s2") != -1), stdout, "Error: Taking a snapshot of a snapshot\n");
+    fd = sfs_fopen("a");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for a failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, later, 10, 0) != -1), stdout, "Error: Writing a file in a snapshot\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK4(verifyFile("c", buffer, 2 * SD_SECTORSIZE));
+    FAIL_BRK3((sfs_stat("e", &st) != -1), stdout, "Error: e is in the snapshot\n");
+
+    // and the live filesystem comes back as it was left
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("a", later, fsize));
+    FAIL_BRK4(verifyFile("d", later, fsize));
+    FAIL_BRK3((sfs_stat("b", &st) != -1), stdout, "Error: b came back\n");
+    FAIL_BRK3((sfs_stat("dir/c", &st) || st.size != 10), stdout, "Error: dir/c is not truncated\n");
+
+    // snapshots come and go as long as there is room in the table, and leave nothing behind
+    fd = sfs_fopen("d");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for d failed\n");
+    for (i = 0; i < 7; i++) {
+        sprintf(name, "more%d", i);
+        FAIL_BRK3(sfs_snapshot(name), stdout, "Error: snapshot %s failed\n", name);
+        FAIL_BRK3((sfs_pwrite(fd, later + i * SD_SECTORSIZE / 2, 1, i * SD_SECTORSIZE / 2) != 1), stdout,
+                "Error: Write failed\n");
+    }
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3((sfs_snapshot("full") != -1), stdout, "Error: Allowing more snapshots than fit\n");
+    FAIL_BRK3(sfs_snapdelete("s1"), stdout, "Error: deleting the snapshot failed\n");
+    FAIL_BRK3((sfs_snapmount("s1") != -1), stdout, "Error: Mounting a deleted snapshot\n");
+    for (i = 0; i < 7; i++) {
+        sprintf(name, "more%d", i);
+        FAIL_BRK3(sfs_snapdelete(name), stdout, "Error: deleting snapshot %s failed\n", name);
+    }
+    FAIL_BRK3((sfs_snapdelete("s1") != -1), stdout, "Error: Deleting a snapshot twice\n");
+    FAIL_BRK3((sfs_fsck(f, 2) != 0), stdout, "Error: fsck found problems after the snapshots went\n");
+    FAIL_BRK4(verifyFile("a", later, fsize));
+    FAIL_BRK4(verifyFile("d", later, fsize));
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    if (f != NULL)
+        fclose(f);
+    SAFE_FREE(buffer);
+    SAFE_FREE(later);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Snapshot Test");
+    return hr;
+}
+
+int cloneTest() {
+    int hr = SUCCESS;
+    int i, j = 50, fd = -1, used, fsize = 20 * SD_SECTORSIZE;
+    char dirName[16], fileName[16];
+    char *buffer = malloc(fsize);
+    char *changed = malloc(fsize);
+    sfs_stat_t st, cst;
+    initBuffer(buffer, fsize);
+    memcpy(changed, buffer, fsize);
+    memset(changed + 5 * SD_SECTORSIZE + 100, 'x', 10);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createSmallFile("tmpl", buffer, fsize));
+    FAIL_BRK4(createSmallFile("small", buffer, 20));
+    FAIL_BRK4(createFolder("dir"));
+    used = usedSectors();
+    FAIL_BRK3((used == -1), stdout, "Error: fsck found problems\n");
+
+    // a clone takes no data sectors
+    FAIL_BRK3(sfs_clone("tmpl", "copy"), stdout, "Error: clone failed\n");
+    FAIL_BRK3(sfs_clone("small", "copy2"), stdout, "Error: clone of an inline file failed\n");
+    FAIL_BRK3((sfs_clone("tmpl", "copy") != -1), stdout, "Error: Cloning over an existing file\n");
+    FAIL_BRK3((sfs_clone("dir", "copy3") != -1), stdout, "Error: Cloning a folder\n");
+    FAIL_BRK3((sfs_clone("nothere", "copy3") != -1), stdout, "Error: Cloning a missing file\n");
+    FAIL_BRK3((sfs_stat("tmpl", &st) || sfs_stat("copy", &cst) || st.size != cst.size
+            || st.numsector != cst.numsector || st.inode == cst.inode), stdout,
+            "Error: The clone doesn't look like its source\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: The clone took sectors of its own\n");
+    FAIL_BRK4(verifyFile("copy", buffer, fsize));
+    FAIL_BRK4(verifyFile("copy2", buffer, 20));
+
+    // writing one of them parts them in that sector only
+    fd = sfs_fopen("copy");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for copy failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, changed + 5 * SD_SECTORSIZE + 100, 10, 5 * SD_SECTORSIZE + 100) != 10), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK4(verifyFile("copy", changed, fsize));
+    FAIL_BRK4(verifyFile("tmpl", buffer, fsize));
+    FAIL_BRK3((usedSectors() != used + 1), stdout, "Error: The write didn't take exactly one sector\n");
+
+    // removing the source leaves the clone whole, then the clone of a clone
+    FAIL_BRK3(sfs_rm("tmpl"), stdout, "Error: deleting tmpl failed\n");
+    FAIL_BRK4(verifyFile("copy", changed, fsize));
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK3(sfs_clone("../copy", "again"), stdout, "Error: clone into a folder failed\n");
+    FAIL_BRK3(sfs_truncate("again", 3 * SD_SECTORSIZE + 1), stdout, "Error: truncate failed\n");
+    FAIL_BRK4(verifyFile("again", changed, 3 * SD_SECTORSIZE + 1));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK4(verifyFile("copy", changed, fsize));
+
+    // the copy can go in another dir by its path
+    FAIL_BRK3(sfs_clone("copy", "dir/other"), stdout, "Error: clone into a path failed\n");
+    FAIL_BRK3((sfs_clone("copy", "/dir/other") != -1), stdout, "Error: Cloning over an existing file in a path\n");
+    FAIL_BRK3((sfs_clone("copy", "nodir/other") != -1), stdout, "Error: Cloning into a missing folder\n");
+    FAIL_BRK3((sfs_stat("other", &st) != -1), stdout, "Error: The clone went in the cwd\n");
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK4(verifyFile("other", changed, fsize));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+
+    // clones and snapshots together, and everything gone again
+    FAIL_BRK3(sfs_snapshot("s"), stdout, "Error: snapshot failed\n");
+    FAIL_BRK3(sfs_rm("copy"), stdout, "Error: deleting copy failed\n");
+    FAIL_BRK3(sfs_rm("copy2"), stdout, "Error: deleting copy2 failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+    FAIL_BRK3(sfs_snapdelete("s"), stdout, "Error: deleting the snapshot failed\n");
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK3(sfs_rm("again"), stdout, "Error: deleting again failed\n");
+    FAIL_BRK3(sfs_rm("other"), stdout, "Error: deleting other failed\n");
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3((usedSectors() != used - 20), stdout, "Error: Sectors were left behind\n");
+
+    // a clone that runs out of inodes for its chain part way leaves nothing behind
+    FAIL_BRK4(createSmallFile("src", buffer, fsize));
+    for (i = 0; j == 50; i++) {
+        FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd to the root failed\n");
+        sprintf(dirName, "f%02d", i);
+        if (sfs_mkdir(dirName)) {
+            FAIL_BRK3(sfs_fcd((sprintf(dirName, "f%02d", i - 1), dirName)), stdout, "Error: cd to %s failed\n", dirName);
+            break;
+        }
+        FAIL_BRK3(sfs_fcd(dirName), stdout, "Error: cd to %s failed\n", dirName);
+        for (j = 0; j < 50; j++) {
+            sprintf(fileName, "%d", j);
+            if ((fd = sfs_fopen(fileName)) == -1)
+                break;
+            FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+            fd = -1;
+        }
+    }
+    FAIL_BRK3((j == 0), stdout, "Error: A folder got no file at all\n");
+    sprintf(fileName, "%d", j - 1); // one inode free again
+    FAIL_BRK3(sfs_rm(fileName), stdout, "Error: deleting %s failed\n", fileName);
+    used = usedSectors();
+    FAIL_BRK3((used == -1), stdout, "Error: fsck found problems\n");
+    FAIL_BRK3((sfs_clone("/src", "/nochain") != -1), stdout, "Error: Cloned without inodes for the chain\n");
+    FAIL_BRK3((sfs_stat("/nochain", &st) != -1), stdout, "Error: The failed clone left its entry\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: The failed clone left sectors or problems behind\n");
+    FAIL_BRK4(createSmallFile("last", buffer, 10));
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    SAFE_FREE(buffer);
+    SAFE_FREE(changed);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Clone Test");
+    return hr;
+}
+
+int defragTest() {
+    int hr = SUCCESS;
+    int fd[3] = {-1, -1, -1};
+    int i, k, n, used, slices = 0, numsector = 12, fsize = 12 * SD_SECTORSIZE;
+    char name[8];
+    char *buffer = malloc(fsize);
+    sfs_fragstat_t before, after;
+    sfs_stat_t st, cst;
+    initBuffer(buffer, fsize);
+
+    // test setup: three files written a sector at a time in turn, so their sectors interleave
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    for (i = 0; i < 3; i++) {
+        sprintf(name, "frag%d", i);
+        fd[i] = sfs_fopen(name);
+        FAIL_BRK3((fd[i] == -1), stdout, "Error: fopen for (%s) failed\n", name);
+    }
+    for (k = 0; k < numsector; k++) {
+        for (i = 0; i < 3; i++) {
+            FAIL_BRK3((sfs_fwrite(fd[i], buffer + k * SD_SECTORSIZE, SD_SECTORSIZE) != SD_SECTORSIZE),
+                    stdout, "Error: Write failed\n");
+            FAIL_BRK3(sfs_fsync(fd[i]), stdout, "Error: fsync failed\n");
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        FAIL_BRK3(sfs_fclose(fd[i]), stdout, "Error: Closing the file failed\n");
+        fd[i] = -1;
+    }
+    FAIL_BRK4(createSmallFile("tmpl", buffer, 2 * SD_SECTORSIZE));
+    FAIL_BRK3(sfs_clone("frag1", "shared"), stdout, "Error: clone failed\n");
+    used = usedSectors();
+    FAIL_BRK3((used == -1), stdout, "Error: fsck found problems\n");
+
+    FAIL_BRK3(sfs_fragstat(&before), stdout, "Error: fragstat failed\n");
+    LOG(stdout, "before: files=%d extents=%d fragmented=%d extents/file=%.2f seek=%.2f\n",
+            before.numfile, before.numextent, before.numfragmented, before.extentperfile, before.avgseek);
+    FAIL_BRK3((before.numfragmented < 3 || before.avgseek <= 1.0), stdout,
+            "Error: The files don't look fragmented\n");
+    FAIL_BRK3((sfs_defrag(0) != -1), stdout, "Error: A slice of no sectors ran\n");
+
+    // small slices until a whole pass has nothing left to do
+    while ((n = sfs_defrag(numsector)) > 0) {
+        FAIL_BRK3((n > 2 * numsector), stdout, "Error: A slice moved %d sectors\n", n);
+        slices++;
+    }
+    FAIL_BRK3((n == -1), stdout, "Error: defrag failed\n");
+    FAIL_BRK3((slices < 2), stdout, "Error: Defragmenting took %d slices\n", slices);
+
+    FAIL_BRK3(sfs_fragstat(&after), stdout, "Error: fragstat failed\n");
+    LOG(stdout, "after: files=%d extents=%d fragmented=%d extents/file=%.2f seek=%.2f\n",
+            after.numfile, after.numextent, after.numfragmented, after.extentperfile, after.avgseek);
+    FAIL_BRK3((after.numfile != before.numfile || after.numextent >= before.numextent
+            || after.avgseek >= before.avgseek), stdout, "Error: Defragmenting didn't help\n");
+    FAIL_BRK3((sfs_stat("frag0", &st) || st.numextent != 1), stdout, "Error: frag0 is in %d runs\n",
+            st.numextent);
+    FAIL_BRK3((sfs_stat("frag2", &st) || st.numextent != 1), stdout, "Error: frag2 is in %d runs\n",
+            st.numextent);
+
+    // the clone and its source still share their sectors
+    FAIL_BRK3((sfs_stat("frag1", &st) || sfs_stat("shared", &cst) || st.numextent != cst.numextent
+            || st.numextent == 1), stdout, "Error: Shared sectors were moved\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: Defragmenting changed the sectors in use\n");
+
+    // the files are whole, also after a remount
+    FAIL_BRK4(refreshDisk());
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    for (i = 0; i < 3; i++) {
+        sprintf(name, "frag%d", i);
+        FAIL_BRK4(verifyFile(name, buffer, fsize));
+    }
+    FAIL_BRK4(verifyFile("shared", buffer, fsize));
+    FAIL_BRK4(verifyFile("tmpl", buffer, 2 * SD_SECTORSIZE));
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: fsck found problems after a remount\n");
+
+    Fail:
+
+    for (i = 0; i < 3; i++) {
+        if (fd[i] != -1)
+            sfs_fclose(fd[i]);
+    }
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Defrag Test");
+    return hr;
+}
+
+int localityTest() {
+    int hr = SUCCESS;
+    int fd = -1;
+    int d, k, n, lo[4], hi[4], numfile = 5, fsize = 2 * SD_SECTORSIZE;
+    char name[16];
+    char *buffer = malloc(fsize);
+    sfs_span_t spans[2];
+    initBuffer(buffer, fsize);
+
+    // test setup: four dirs filled a file at a time in turn
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    for (d = 0; d < 4; d++) {
+        sprintf(name, "group%d", d);
+        FAIL_BRK4(createFolder(name));
+    }
+    for (k = 0; k < numfile; k++) {
+        for (d = 0; d < 4; d++) {
+            sprintf(name, "group%d", d);
+            FAIL_BRK3(sfs_fcd(name), stdout, "Error: cd to (%s) failed\n", name);
+            sprintf(name, "f%d", k);
+            FAIL_BRK4(createSmallFile(name, buffer, fsize));
+            FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+        }
+    }
+
+    // the files of a dir stay together, away from the files of the others
+    for (d = 0; d < 4; d++) {
+        sprintf(name, "group%d", d);
+        FAIL_BRK3(sfs_fcd(name), stdout, "Error: cd to (%s) failed\n", name);
+        lo[d] = SD_NUMSECTORS;
+        hi[d] = 0;
+        for (k = 0; k < numfile; k++) {
+            sprintf(name, "f%d", k);
+            FAIL_BRK4(verifyFile(name, buffer, fsize));
+            fd = sfs_fopen(name);
+            FAIL_BRK3((fd == -1), stdout, "Error: fopen for (%s) failed\n", name);
+            n = sfs_mapread(fd, 0, fsize, spans, 2);
+            FAIL_BRK3((n < 1), stdout, "Error: mapread failed\n");
+            lo[d] = (spans[0].sector < lo[d]) ? spans[0].sector : lo[d];
+            hi[d] = (spans[n - 1].sector > hi[d]) ? spans[n - 1].sector : hi[d];
+            FAIL_BRK3(sfs_unmap(spans, n), stdout, "Error: unmap failed\n");
+            FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+            fd = -1;
+        }
+        FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+        LOG(stdout, "group%d: sectors %d to %d\n", d, lo[d], hi[d]);
+        FAIL_BRK3((hi[d] - lo[d] >= 2 * numfile * fsize / SD_SECTORSIZE), stdout,
+                "Error: The files of group%d are spread over sectors %d to %d\n", d, lo[d], hi[d]);
+    }
+    for (d = 1; d < 4; d++) {
+        for (k = 0; k < d; k++) {
+            FAIL_BRK3((lo[d] <= hi[k] && lo[k] <= hi[d]), stdout,
+                    "Error: The files of group%d and group%d are mixed\n", k, d);
+        }
+    }
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Locality Test");
+    return hr;
+}
+
+int mkimageTest() {
+    int hr = SUCCESS;
+    int i, numents = 0, numfile = 40, fsize = 12 * SD_SECTORSIZE;
+    char name[16];
+    char *buffer = malloc(fsize);
+    sfs_imgent_t *ents = calloc(numfile + 8, sizeof(sfs_imgent_t));
+    sfs_stat_t st;
+    initBuffer(buffer, fsize);
+
+    // the root, a dir too big for one sector, a nested dir and a big, a small and an empty file
+    ents[numents++].type = 1;
+    strcpy(ents[numents].name, "many");
+    ents[numents++].type = 1;
+    for (i = 0; i < numfile; i++) {
+        sprintf(ents[numents].name, "f%02d", i);
+        ents[numents].parent = 1;
+        ents[numents].type = 2;
+        ents[numents].size = 1 + i * 97;
+        ents[numents++].data = buffer;
+    }
+    strcpy(ents[numents].name, "nested");
+    ents[numents++].type = 1;
+    strcpy(ents[numents].name, "big");
+    ents[numents].parent = numents - 1;
+    ents[numents].type = 2;
+    ents[numents].size = fsize;
+    ents[numents++].data = buffer;
+    strcpy(ents[numents].name, "small");
+    ents[numents].type = 2;
+    ents[numents].size = 20;
+    ents[numents++].data = buffer;
+    strcpy(ents[numents].name, "empty");
+    ents[numents++].type = 2;
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK3(sfs_mkimage(ents, numents), stdout, "Error: mkimage failed\n");
+
+    FAIL_BRK3(sfs_fcd("many"), stdout, "Error: cd to many failed\n");
+    for (i = 0; i < numfile; i++) {
+        sprintf(name, "f%02d", i);
+        FAIL_BRK4(verifyFile(name, buffer, 1 + i * 97));
+    }
+    FAIL_BRK3(sfs_fcd("/nested"), stdout, "Error: cd to nested failed\n");
+    FAIL_BRK4(verifyFile("big", buffer, fsize));
+    FAIL_BRK3((sfs_stat("big", &st) || st.numextent != 1 || st.numinode != 2), stdout,
+            "Error: big is in %d runs\n", st.numextent);
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK4(verifyFile("small", buffer, 20));
+    FAIL_BRK3((sfs_stat("empty", &st) || st.size != 0 || st.type != 2), stdout, "Error: empty is not empty\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+
+    // it is a filesystem like any other
+    FAIL_BRK4(createSmallFile("later", buffer, fsize));
+    FAIL_BRK3(sfs_fcd("many"), stdout, "Error: cd to many failed\n");
+    FAIL_BRK3(sfs_rm("f07"), stdout, "Error: deleting f07 failed\n");
+    FAIL_BRK4(createFolder("sub"));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+
+    // a tree it can't build leaves the filesystem alone
+    strcpy(ents[numents - 1].name, "small");
+    FAIL_BRK3((sfs_mkimage(ents, numents) != -1), stdout, "Error: Two files with one name\n");
+    strcpy(ents[numents - 1].name, "empty");
+    ents[numents - 1].parent = numents - 1;
+    FAIL_BRK3((sfs_mkimage(ents, numents) != -1), stdout, "Error: A file is its own dir\n");
+    ents[numents - 1].parent = 0;
+    ents[numents - 2].size = SD_NUMSECTORS * SD_SECTORSIZE;
+    FAIL_BRK3((sfs_mkimage(ents, numents) != -1), stdout, "Error: A tree too big for the disk\n");
+    FAIL_BRK4(verifyFile("later", buffer, fsize));
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    SAFE_FREE(ents);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Mkimage Test");
+    return hr;
+}
+
+int readimageTest() {
+    int hr = SUCCESS;
+    int fd = -1;
+    int i, numents = 0, found = 0, fsize = 10 * SD_SECTORSIZE;
+    char *buffer = malloc(fsize);
+    char *holey = calloc(fsize, 1);
+    sfs_imgent_t *ents = NULL;
+    initBuffer(buffer, fsize);
+    memcpy(holey + 6 * SD_SECTORSIZE, buffer, 100);
+
+    // test setup: a file, a clone of it, a file with a hole, a small one and one still in its write buffer
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createFolder("dir"));
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK4(createSmallFile("data", buffer, fsize));
+    FAIL_BRK3(sfs_clone("data", "copy"), stdout, "Error: clone failed\n");
+    fd = sfs_fopen("holey");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for holey failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer, 100, 6 * SD_SECTORSIZE) != 100), stdout, "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK4(createSmallFile("small", buffer, 20));
+    fd = sfs_fopen("buffered");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for buffered failed\n");
+    FAIL_BRK3((sfs_fwrite(fd, buffer, 700) != 700), stdout, "Error: Write failed\n");
+
+    numents = sfs_readimage(&ents);
+    FAIL_BRK3((numents != 7), stdout, "Error: readimage found %d entries\n", numents);
+    FAIL_BRK3((ents[0].type != 1), stdout, "Error: The root is not first\n");
+    for (i = 1; i < numents; i++) {
+        FAIL_BRK3((ents[i].parent >= i || ents[ents[i].parent].type != 1), stdout,
+                "Error: %s comes before its dir\n", ents[i].name);
+        if (!strcmp(ents[i].name, "data") || !strcmp(ents[i].name, "copy"))
+            found += (ents[i].size == fsize && !memcmp(ents[i].data, buffer, fsize));
+        else if (!strcmp(ents[i].name, "holey"))
+            found += (ents[i].size == 6 * SD_SECTORSIZE + 100 && !memcmp(ents[i].data, holey, ents[i].size));
+        else if (!strcmp(ents[i].name, "small"))
+            found += (ents[i].size == 20 && !memcmp(ents[i].data, buffer, 20));
+        else if (!strcmp(ents[i].name, "buffered"))
+            found += (ents[i].size == 700 && !memcmp(ents[i].data, buffer, 700));
+        else if (!strcmp(ents[i].name, "dir"))
+            found += (ents[i].type == 1 && ents[i].parent == 0);
+    }
+    FAIL_BRK3((found != 6), stdout, "Error: Only %d of 6 entries were read back right\n", found);
+
+    // what it read builds the same tree again
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    FAIL_BRK3(sfs_mkimage(ents, numents), stdout, "Error: mkimage failed\n");
+    FAIL_BRK4(verifyFile("small", buffer, 20));
+    FAIL_BRK4(verifyFile("buffered", buffer, 700));
+    FAIL_BRK3(sfs_fcd("dir"), stdout, "Error: cd to dir failed\n");
+    FAIL_BRK4(verifyFile("data", buffer, fsize));
+    FAIL_BRK4(verifyFile("copy", buffer, fsize));
+    FAIL_BRK4(verifyFile("holey", holey, 6 * SD_SECTORSIZE + 100));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    for (i = 0; ents != NULL && i < numents; i++)
+        SAFE_FREE(ents[i].data);
+    SAFE_FREE(ents);
+    SAFE_FREE(buffer);
+    SAFE_FREE(holey);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Readimage Test");
+    return hr;
+}
+
+int rmRecursiveTest() {
+    int hr = SUCCESS;
+    int i, k, fd, used, depth = 60, deep = 900, fsize = 3 * SD_SECTORSIZE;
+    char name[16];
+    char *buffer = malloc(fsize);
+    initBuffer(buffer, fsize);
+
+    // test setup: a deep tree with a file on every level and some wide dirs
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createSmallFile("keep", buffer, fsize));
+    used = usedSectors();
+    FAIL_BRK3((used == -1), stdout, "Error: fsck found problems\n");
+    FAIL_BRK4(createFolder("tree"));
+    FAIL_BRK3(sfs_fcd("tree"), stdout, "Error: cd to tree failed\n");
+    for (i = 0; i < depth; i++) {
+        FAIL_BRK4(createSmallFile("f", buffer, fsize));
+        FAIL_BRK4(createSmallFile("tiny", buffer, 10));
+        for (k = 0; i % 20 == 0 && k < 30; k++) {
+            sprintf(name, "w%02d", k);
+            FAIL_BRK4(createSmallFile(name, buffer, SD_SECTORSIZE + k));
+        }
+        sprintf(name, "lvl%02d", i);
+        FAIL_BRK4(createFolder(name));
+        FAIL_BRK3(sfs_fcd(name), stdout, "Error: cd to (%s) failed\n", name);
+    }
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3(sfs_clone("tree/lvl00/f", "outside"), stdout, "Error: clone failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems\n");
+
+    FAIL_BRK3((sfs_rm_recursive("nothere") != -1), stdout, "Error: Removing a missing tree\n");
+    FAIL_BRK3((sfs_rm_recursive("..") != -1), stdout, "Error: Removing ..\n");
+    FAIL_BRK3(sfs_rm_recursive("tree"), stdout, "Error: rm_recursive failed\n");
+
+    // all of it is gone but what the clone shares, which is the clone's now
+    FAIL_BRK3((sfs_fcd("tree") != -1), stdout, "Error: tree is still there\n");
+    FAIL_BRK4(verifyFile("outside", buffer, fsize));
+    FAIL_BRK4(verifyFile("keep", buffer, fsize));
+    FAIL_BRK3((usedSectors() != used + 3), stdout, "Error: The tree left sectors behind\n");
+    FAIL_BRK3(sfs_rm_recursive("outside"), stdout, "Error: rm_recursive of a file failed\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: The clone left sectors behind\n");
+
+    // and the space is there to use again
+    FAIL_BRK4(createFolder("tree"));
+    FAIL_BRK3(sfs_fcd("tree"), stdout, "Error: cd to tree failed\n");
+    FAIL_BRK4(createSmallFile("f", buffer, fsize));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK4(refreshDisk());
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3(sfs_fcd("tree"), stdout, "Error: cd to tree failed\n");
+    FAIL_BRK4(verifyFile("f", buffer, fsize));
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems after a remount\n");
+
+    // a chain of dirs far too big for one journal group comes down in many
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    used = usedSectors();
+    FAIL_BRK4(createFolder("deep"));
+    FAIL_BRK3(sfs_fcd("deep"), stdout, "Error: cd to deep failed\n");
+    for (i = 0; i < deep; i++) {
+        FAIL_BRK4(createFolder("d"));
+        FAIL_BRK3(sfs_fcd("d"), stdout, "Error: cd to d failed on level %d\n", i);
+    }
+    FAIL_BRK4(createSmallFile("f", buffer, fsize));
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3(sfs_rm_recursive("deep"), stdout, "Error: rm_recursive of %d levels failed\n", deep);
+    FAIL_BRK3((sfs_fcd("deep") != -1), stdout, "Error: deep is still there\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: The chain left sectors behind\n");
+    FAIL_BRK4(refreshDisk());
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_fcd("deep") != -1), stdout, "Error: deep is back after a remount\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: fsck found problems after a remount\n");
+
+    // a file whose erase alone fills much of a group, in a dir too wide for one sector
+    FAIL_BRK4(createFolder("bulk"));
+    FAIL_BRK3(sfs_fcd("bulk"), stdout, "Error: cd to bulk failed\n");
+    for (i = 0; i < 60; i++) {
+        sprintf(name, "s%02d", i);
+        FAIL_BRK4(createSmallFile(name, buffer, 10));
+    }
+    fd = sfs_fopen("huge");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for huge failed\n");
+    FAIL_BRK3(sfs_fallocate(fd, 0, 1200 * SD_SECTORSIZE), stdout, "Error: fallocate failed\n");
+    FAIL_BRK3((sfs_pwrite(fd, buffer, fsize, 1200 * SD_SECTORSIZE - fsize) != fsize), stdout,
+            "Error: Write failed\n");
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3(sfs_rm_recursive("bulk"), stdout, "Error: rm_recursive of bulk failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync after rm_recursive failed\n");
+    FAIL_BRK4(refreshDisk());
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_fcd("bulk") != -1), stdout, "Error: bulk is back after a remount\n");
+    FAIL_BRK3((usedSectors() != used), stdout, "Error: bulk left sectors behind\n");
+
+    Fail:
+
+    SAFE_FREE(buffer);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Rm Recursive Test");
+    return hr;
+}
+
+int renameTest() {
+    int hr = SUCCESS;
+    int fd = -1, i, used, fsize = 40 * SD_SECTORSIZE;
+    char name[16];
+    char *buffer = malloc(fsize);
+    char *other = malloc(fsize);
+    sfs_stat_t st, nst;
+    initBuffer(buffer, fsize);
+    memset(other, 'o', fsize);
+
+    // test setup
+    FAIL_BRK4(initAndLoadDisk());
+    FAIL_BRK4(initFS());
+    FAIL_BRK4(createSmallFile("big.tmp", buffer, fsize));
+    FAIL_BRK4(createSmallFile("big", other, 100));
+    FAIL_BRK4(createFolder("a"));
+    FAIL_BRK4(createFolder("b"));
+    FAIL_BRK3(sfs_fcd("b"), stdout, "Error: cd to b failed\n");
+    for (i = 0; i < 19; i++) { // b is full, it has to grow to take one more
+        sprintf(name, "x%02d", i);
+        FAIL_BRK4(createSmallFile(name, buffer, 10));
+    }
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3(sfs_fcd("a"), stdout, "Error: cd to a failed\n");
+    FAIL_BRK4(createFolder("sub"));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3(sfs_stat("big.tmp", &st), stdout, "Error: stat failed\n");
+
+    // the publish step: a temp file takes the place of the old one, its data stays where it is
+    fd = sfs_fopen("big");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for big failed\n");
+    FAIL_BRK3(sfs_rename("big.tmp", "big"), stdout, "Error: rename over big failed\n");
+    FAIL_BRK3((sfs_stat("big.tmp", &nst) != -1), stdout, "Error: big.tmp is still there\n");
+    FAIL_BRK3((sfs_stat("big", &nst) || nst.inode != st.inode || nst.numextent != st.numextent), stdout,
+            "Error: big is not what big.tmp was\n");
+    FAIL_BRK4(verifyFile("big", buffer, fsize));
+    FAIL_BRK3(sfs_fclose(fd), stdout, "Error: Closing the file failed\n");
+    fd = -1;
+    used = usedSectors();
+    FAIL_BRK3((used == -1), stdout, "Error: fsck found problems\n");
+
+    // within a dir, across dirs, into a full dir and back up
+    FAIL_BRK3(sfs_rename("big", "renamed"), stdout, "Error: rename within the dir failed\n");
+    FAIL_BRK3(sfs_rename("renamed", "a/sub/moved"), stdout, "Error: rename into a/sub failed\n");
+    FAIL_BRK3(sfs_rename("/a/sub/moved", "b/last"), stdout, "Error: rename into b failed\n");
+    FAIL_BRK3(sfs_fcd("b"), stdout, "Error: cd to b failed\n");
+    FAIL_BRK4(verifyFile("last", buffer, fsize));
+    FAIL_BRK3(sfs_rename("last", "../back"), stdout, "Error: rename to .. failed\n");
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK4(verifyFile("back", buffer, fsize));
+    FAIL_BRK3((sfs_stat("back", &nst) || nst.inode != st.inode), stdout, "Error: back is another file\n");
+
+    // a dir takes its ".." along
+    FAIL_BRK3(sfs_rename("a/sub", "b/sub"), stdout, "Error: rename of a dir failed\n");
+    FAIL_BRK3(sfs_fcd("b/sub"), stdout, "Error: cd to b/sub failed\n");
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd .. failed\n");
+    FAIL_BRK3(sfs_stat("x00", &nst), stdout, "Error: .. of sub is not b\n");
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3((usedSectors() != used + 1), stdout, "Error: fsck found problems, or b didn't grow\n");
+
+    // what must not work
+    FAIL_BRK3((sfs_rename("nothere", "x") != -1), stdout, "Error: Renaming a missing file\n");
+    FAIL_BRK3((sfs_rename("back", "nodir/x") != -1), stdout, "Error: Renaming into a missing dir\n");
+    FAIL_BRK3((sfs_rename("b", "b/sub/b") != -1), stdout, "Error: Moving a dir inside itself\n");
+    FAIL_BRK3((sfs_rename("back", "a") != -1), stdout, "Error: A file took the place of a dir\n");
+    FAIL_BRK3((sfs_rename("a", "back") != -1), stdout, "Error: A dir took the place of a file\n");
+    FAIL_BRK3((sfs_rename("back", "b/..") != -1), stdout, "Error: Renaming to ..\n");
+    FAIL_BRK3(sfs_rename("back", "back"), stdout, "Error: Renaming to the same name failed\n");
+
+    // and it all is on the disk
+    FAIL_BRK4(refreshDisk());
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK4(verifyFile("back", buffer, fsize));
+    FAIL_BRK3(sfs_fcd("b/sub"), stdout, "Error: cd to b/sub failed\n");
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3((usedSectors() != used + 1), stdout, "Error: fsck found problems after a remount\n");
+
+    // a fails to give up its entry after c took it: a snapshot shares a and the disk is full
+    FAIL_BRK3(sfs_fcd("a"), stdout, "Error: cd to a failed\n");
+    FAIL_BRK4(createSmallFile("y", other, 10));
+    FAIL_BRK3(sfs_fcd(".."), stdout, "Error: cd back to .. failed\n");
+    FAIL_BRK3(sfs_snapshot("before"), stdout, "Error: snapshot failed\n");
+    FAIL_BRK4(createFolder("c"));
+    fd = sfs_fopen("fill");
+    FAIL_BRK3((fd == -1), stdout, "Error: fopen for fill failed\n");
+    while (sfs_fwrite(fd, buffer, fsize) == fsize);
+    while (sfs_fwrite(fd, buffer, SD_SECTORSIZE) == SD_SECTORSIZE);
+    sfs_fclose(fd);
+    fd = -1;
+    FAIL_BRK3((sfs_rename("a/y", "c/y") != -1), stdout, "Error: Renamed out of a shared dir on a full disk\n");
+    FAIL_BRK3(sfs_stat("a/y", &nst), stdout, "Error: a/y is gone\n");
+    FAIL_BRK3((sfs_stat("c/y", &nst) != -1), stdout, "Error: c/y is there after a failed rename\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK4(refreshDisk());
+    FAIL_BRK3(sfs_mount(), stdout, "Error: mount failed\n");
+    FAIL_BRK3((sfs_stat("c/y", &nst) != -1), stdout, "Error: c/y is there after a remount\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems after a failed rename\n");
+
+    // with room again it goes through
+    FAIL_BRK3(sfs_rm("fill"), stdout, "Error: deleting fill failed\n");
+    FAIL_BRK3(sfs_sync(), stdout, "Error: sync failed\n");
+    FAIL_BRK3(sfs_rename("a/y", "c/y"), stdout, "Error: rename into c failed\n");
+    FAIL_BRK3(sfs_fcd("c"), stdout, "Error: cd to c failed\n");
+    FAIL_BRK4(verifyFile("y", other, 10));
+    FAIL_BRK3(sfs_fcd("/"), stdout, "Error: cd / failed\n");
+    FAIL_BRK3((usedSectors() == -1), stdout, "Error: fsck found problems after the rename\n");
+
+    Fail:
+
+    if (fd != -1)
+        sfs_fclose(fd);
+    SAFE_FREE(buffer);
+    SAFE_FREE(other);
+    saveAndCloseDisk();
+    PRINT_RESULTS("Rename Test");
     return hr;
 }
 
@@ -1372,3 +3643,40 @@ int testFile(char* name, int fsize) {
     return -1;
 }
 
+/**
+ * The CRC32C of a buffer one bit at a time, to check sfs_crc32c against.
+ *
+ * @param data the buffer
+ * @param len its length in bytes
+ * @return the CRC
+ */
+unsigned int crc32cBitwise(unsigned char *data, int len) {
+    unsigned int crc = ~0u;
+    int i, k;
+    for (i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+    }
+    return ~crc;
+}
+
+/**
+ * Runs sfs_fsck and reads back how many sectors the files and dirs use.
+ *
+ * @return that number, or -1 if fsck found problems or failed
+ */
+int usedSectors() {
+    char line[128];
+    int used = -1;
+    FILE *f = tmpfile();
+    if (f == NULL)
+        return -1;
+    if (sfs_fsck(f, 1) == 0) {
+        rewind(f);
+        while (fgets(line, sizeof(line), f) != NULL)
+            sscanf(line, "summary dirs=%*d files=%*d sectors=%d", &used);
+    }
+    fclose(f);
+    return used;
+}
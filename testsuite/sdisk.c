@@ -21,8 +21,22 @@
  */
 
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "sdisk.h"
 
+#define SD_IMAGEMAGIC "SDZIMG01" /* starts an image in the sparse format */
+#define SD_CHUNKSECTORS 16 /* sectors compressed together */
+#define SD_HASHBITS 12 /* size of the match finder's table */
+#define SD_MINMATCH 4 /* shortest match worth an offset */
+
+typedef struct {
+    char magic[8]; /* SD_IMAGEMAGIC */
+    int numSectors;
+    int sectorSize;
+    int chunkSectors;
+} ImageHeader; /* what a sparse image starts with */
+
 static int threshold;
 
 static Sector *disk; /* disk in memory - static makes it
@@ -34,6 +48,19 @@ static long long numWrites;
 static long long numBlocksSeeked;
 static long long lastAccessedBlock;
 
+static unsigned char dirty[(SD_NUMSECTORS + 7) / 8]; /* sectors written since
+ the image was last saved or loaded */
+static char *imageFile; /* the file the image was last saved to or loaded
+ from, NULL if the disk differs from every file */
+static int imageCompressed; /* imageFile is in the sparse format */
+
+static void SD_setImageFile(char* file, int compressed);
+static unsigned char* SD_emitSequence(unsigned char* op, const unsigned char* literals, int litLen,
+        int offset, int matchLen);
+static int SD_compress(const unsigned char* src, int len, unsigned char* dst);
+static int SD_decompress(const unsigned char* src, int len, unsigned char* dst, int outLen);
+static int SD_loadCompressed(FILE* diskFile, ImageHeader* header);
+
 /*
  * SD_initDisk: Initialize disk area - CALL THIS FIRST
  *
@@ -57,6 +84,9 @@ int SD_initDisk() {
     numWrites = 0;
     numBlocksSeeked = 0;
     lastAccessedBlock = 0;
+    free(imageFile);
+    imageFile = NULL;
+    memset(dirty, 0, sizeof(dirty));
     return 0;
 } /* !SD_initDisk */
 
@@ -72,6 +102,8 @@ int SD_initDisk() {
 int SD_finalizeDisk() {
     if (disk != NULL)
         free(disk);
+    free(imageFile);
+    imageFile = NULL;
     fprintf(stdout, "SD: Number of reads: %20lld\tNumber of writes: %20lld\tNumber of blocks seek over: %20lld\n",
             numReads, numWrites, numBlocksSeeked);
 
@@ -107,19 +139,158 @@ int SD_saveDisk(char* file) {
     if ((fwrite(disk, sizeof(Sector), SD_NUMSECTORS, diskFile))
             != SD_NUMSECTORS) {
         fclose(diskFile);
+        free(imageFile); /* the file is neither image now */
+        imageFile = NULL;
         sderrno = E_WRITING_FILE;
         return -1;
     }
 
     /* clean up and return */
     fclose(diskFile);
+    SD_setImageFile(file, 0);
 
     return 0;
 } /* !SD_saveDisk */
 
 /*
- * SD_loadDisk: Load current disk image from disk; the virtual disk
- *   MUST be created first
+ * SD_saveDiskIncremental: Save current disk image to disk, writing only
+ *   the sectors written since it was last saved to or loaded from the
+ *   same file; runs of them go out with one pwrite each. Any other file
+ *   gets the whole image, as with SD_saveDisk, and a sparse image is
+ *   saved whole again with SD_saveDiskCompressed
+ *
+ * Parameters: file with disk image
+ *
+ * Returns: 0 if OK, -1 otherwise
+ *
+ */
+int SD_saveDiskIncremental(char* file) {
+    int fd, first, last;
+    struct stat st;
+
+    /* parameters check */
+    if (file == NULL) {
+        sderrno = E_INVALID_PARAM;
+        return -1;
+    }
+
+    /* the file must still hold the image the dirty sectors are counted from */
+    if (imageFile == NULL || strcmp(file, imageFile) != 0)
+        return SD_saveDisk(file);
+    if (imageCompressed)
+        return SD_saveDiskCompressed(file);
+    if ((fd = open(file, O_WRONLY)) == -1) {
+        sderrno = E_OPENING_FILE;
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size != (off_t) sizeof(Sector) * SD_NUMSECTORS) {
+        close(fd);
+        return SD_saveDisk(file);
+    }
+
+    /* write the dirty runs in place */
+    for (first = 0; first < SD_NUMSECTORS; first = last) {
+        if (!(dirty[first / 8] & (1 << (first % 8)))) {
+            last = first + 1;
+            continue;
+        }
+        for (last = first + 1; last < SD_NUMSECTORS && (dirty[last / 8] & (1 << (last % 8))); last++)
+            ;
+        if (pwrite(fd, disk + first, sizeof(Sector) * (last - first), (off_t) sizeof(Sector) * first)
+                != (ssize_t) sizeof(Sector) * (last - first)) {
+            close(fd);
+            sderrno = E_WRITING_FILE;
+            return -1;
+        }
+    }
+
+    /* clean up and return */
+    if (close(fd) == -1) {
+        sderrno = E_WRITING_FILE;
+        return -1;
+    }
+    memset(dirty, 0, sizeof(dirty));
+    return 0;
+} /* !SD_saveDiskIncremental */
+
+/*
+ * SD_saveDiskCompressed: Save current disk image to disk in the sparse
+ *   format: a header, a bitmap of the sectors that are not all zero,
+ *   then those sectors, SD_CHUNKSECTORS at a time, each chunk compressed
+ *   or, if that doesn't make it smaller, stored. Zero sectors take no
+ *   room at all. SD_loadDisk reads either format - careful it
+ *   overwrites a pre-existing file
+ *
+ * Parameters: file with disk image
+ *
+ * Returns: 0 if OK, -1 otherwise
+ *
+ */
+int SD_saveDiskCompressed(char* file) {
+    static const Sector zeroSector;
+    static unsigned char chunk[SD_CHUNKSECTORS * SD_SECTORSIZE];
+    static unsigned char packed[SD_CHUNKSECTORS * SD_SECTORSIZE * 2];
+    unsigned char present[(SD_NUMSECTORS + 7) / 8];
+    ImageHeader header;
+    FILE* diskFile;
+    int i, first, count, len, failed = 0;
+
+    /* parameters check */
+    if (file == NULL) {
+        sderrno = E_INVALID_PARAM;
+        return -1;
+    }
+
+    /* open disk file */
+    if ((diskFile = fopen(file, "w")) == NULL) {
+        sderrno = E_OPENING_FILE;
+        return -1;
+    }
+
+    /* the header and which sectors are there */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SD_IMAGEMAGIC, sizeof(header.magic));
+    header.numSectors = SD_NUMSECTORS;
+    header.sectorSize = SD_SECTORSIZE;
+    header.chunkSectors = SD_CHUNKSECTORS;
+    memset(present, 0, sizeof(present));
+    for (i = 0; i < SD_NUMSECTORS; i++)
+        if (memcmp(disk + i, &zeroSector, sizeof(Sector)) != 0)
+            present[i / 8] |= 1 << (i % 8);
+    failed = fwrite(&header, sizeof(header), 1, diskFile) != 1
+            || fwrite(present, sizeof(present), 1, diskFile) != 1;
+
+    /* and the chunks of them */
+    for (first = 0; first < SD_NUMSECTORS && !failed; first += SD_CHUNKSECTORS) {
+        for (i = first, count = 0; i < first + SD_CHUNKSECTORS && i < SD_NUMSECTORS; i++)
+            if (present[i / 8] & (1 << (i % 8)))
+                memcpy(chunk + count++ * SD_SECTORSIZE, disk + i, sizeof(Sector));
+        if (count == 0)
+            continue;
+        len = SD_compress(chunk, count * SD_SECTORSIZE, packed);
+        if (len >= count * SD_SECTORSIZE) { /* not worth it, store it */
+            len = count * SD_SECTORSIZE;
+            memcpy(packed, chunk, len);
+        }
+        failed = fwrite(&len, sizeof(len), 1, diskFile) != 1
+                || fwrite(packed, len, 1, diskFile) != 1;
+    }
+
+    /* clean up and return */
+    if (fclose(diskFile) != 0 || failed) {
+        free(imageFile); /* the file is neither image now */
+        imageFile = NULL;
+        sderrno = E_WRITING_FILE;
+        return -1;
+    }
+    SD_setImageFile(file, 1);
+    return 0;
+} /* !SD_saveDiskCompressed */
+
+/*
+ * SD_loadDisk: Load current disk image from disk, saved by either
+ *   SD_saveDisk or SD_saveDiskCompressed; the virtual disk MUST be
+ *   created first
  *
  * Parameters: file with disk image
  *
@@ -128,6 +299,8 @@ int SD_saveDisk(char* file) {
  */
 int SD_loadDisk(char* file) {
     FILE* diskFile;
+    ImageHeader header;
+    int compressed, hr;
 
     /* parameters check */
     if (file == NULL) {
@@ -141,15 +314,26 @@ int SD_loadDisk(char* file) {
         return -1;
     }
 
-    /* read disk image into memory */
-    if ((fread(disk, sizeof(Sector), SD_NUMSECTORS, diskFile)) != SD_NUMSECTORS) {
+    /* read disk image into memory, in whichever format it was saved */
+    compressed = fread(&header, sizeof(header), 1, diskFile) == 1
+            && memcmp(header.magic, SD_IMAGEMAGIC, sizeof(header.magic)) == 0;
+    if (compressed)
+        hr = SD_loadCompressed(diskFile, &header);
+    else {
+        rewind(diskFile);
+        hr = (fread(disk, sizeof(Sector), SD_NUMSECTORS, diskFile) != SD_NUMSECTORS) ? -1 : 0;
+    }
+    if (hr) {
         fclose(diskFile);
+        free(imageFile); /* the disk is part old image, part file */
+        imageFile = NULL;
         sderrno = E_READING_FILE;
         return -1;
     }
 
     /* clean up and return */
     fclose(diskFile);
+    SD_setImageFile(file, compressed);
     return 0;
 } /* !SD_loadDisk */
 
@@ -219,8 +403,234 @@ int SD_write(int sector, void *buf) {
         sderrno = E_MEM_OP;
         return -1;
     }
+    dirty[sector / 8] |= 1 << (sector % 8);
     numWrites++;
     numBlocksSeeked += abs(lastAccessedBlock - sector);
     lastAccessedBlock = sector;
     return 0;
 } /* !SD_write */
+
+/*
+ * SD_numDirty: Count the sectors SD_saveDiskIncremental would write
+ *
+ * Parameters: -
+ *
+ * Returns: the number of sectors written since the last save or load
+ *
+ */
+int SD_numDirty() {
+    int i, count = 0;
+
+    for (i = 0; i < SD_NUMSECTORS; i++)
+        if (dirty[i / 8] & (1 << (i % 8)))
+            count++;
+    return count;
+} /* !SD_numDirty */
+
+/*
+ * SD_numReads: Count the sectors read since the disk was initialized
+ *
+ * Parameters: -
+ *
+ * Returns: the number of successful SD_read calls
+ *
+ */
+long long SD_numReads() {
+    return numReads;
+} /* !SD_numReads */
+
+/*
+ * SD_setImageFile: Remember that the disk now matches file, so later
+ *   incremental saves to it need only the sectors written from now on
+ *
+ * Parameters: file with disk image, and whether it is in the sparse format
+ *
+ * Returns: -
+ *
+ */
+static void SD_setImageFile(char* file, int compressed) {
+    free(imageFile);
+    imageFile = strdup(file);
+    imageCompressed = compressed;
+    memset(dirty, 0, sizeof(dirty));
+} /* !SD_setImageFile */
+
+/*
+ * SD_emitSequence: Append one sequence to a compressed chunk: a token
+ *   with the lengths of the literals and the match, the literals, then
+ *   the offset of the match; lengths of 15 and more go on in extra
+ *   bytes. The last sequence of a chunk has no match
+ *
+ * Parameters: where to write, the literals and their length, the
+ *   offset back to the match (0 for none) and its length
+ *
+ * Returns: where the next sequence goes
+ *
+ */
+static unsigned char* SD_emitSequence(unsigned char* op, const unsigned char* literals, int litLen,
+        int offset, int matchLen) {
+    unsigned char *token = op++;
+    int n;
+
+    *token = (litLen < 15 ? litLen : 15) << 4;
+    if (litLen >= 15) {
+        for (n = litLen - 15; n >= 255; n -= 255)
+            *op++ = 255;
+        *op++ = n;
+    }
+    memcpy(op, literals, litLen);
+    op += litLen;
+    if (offset == 0)
+        return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    matchLen -= SD_MINMATCH;
+    *token |= (matchLen < 15 ? matchLen : 15);
+    if (matchLen >= 15) {
+        for (n = matchLen - 15; n >= 255; n -= 255)
+            *op++ = 255;
+        *op++ = n;
+    }
+    return op;
+} /* !SD_emitSequence */
+
+/*
+ * SD_compress: Compress a chunk LZ4 style: a hash of the next four bytes
+ *   finds the last place they were seen, and a match of four bytes or
+ *   more within 64K back is sent as an offset and a length instead of
+ *   the bytes
+ *
+ * Parameters: the chunk, its length and where to put it, which must
+ *   have room for len + len / 255 + 16 bytes
+ *
+ * Returns: the compressed length
+ *
+ */
+static int SD_compress(const unsigned char* src, int len, unsigned char* dst) {
+    int table[1 << SD_HASHBITS];
+    const unsigned char *ip = src, *anchor = src, *end = src + len, *match;
+    unsigned char *op = dst;
+    unsigned int seq, hash;
+    int i, matchLen;
+
+    for (i = 0; i < (1 << SD_HASHBITS); i++)
+        table[i] = -1;
+    while (ip + SD_MINMATCH <= end) {
+        memcpy(&seq, ip, sizeof(seq));
+        hash = (seq * 2654435761u) >> (32 - SD_HASHBITS);
+        match = (table[hash] == -1) ? NULL : src + table[hash];
+        table[hash] = ip - src;
+        if (match == NULL || ip - match > 65535 || memcmp(match, ip, SD_MINMATCH) != 0) {
+            ip++;
+            continue;
+        }
+        for (matchLen = SD_MINMATCH; ip + matchLen < end && match[matchLen] == ip[matchLen]; matchLen++)
+            ;
+        op = SD_emitSequence(op, anchor, ip - anchor, ip - match, matchLen);
+        ip += matchLen;
+        anchor = ip;
+    }
+    op = SD_emitSequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+} /* !SD_compress */
+
+/*
+ * SD_decompress: Undo SD_compress, checking every length and offset
+ *   against both buffers
+ *
+ * Parameters: the compressed chunk, its length, and where to put the
+ *   chunk and how long it must come out
+ *
+ * Returns: 0 if OK, -1 if the chunk is corrupt
+ *
+ */
+static int SD_decompress(const unsigned char* src, int len, unsigned char* dst, int outLen) {
+    const unsigned char *ip = src, *end = src + len;
+    unsigned char *op = dst, *oend = dst + outLen;
+    int token, litLen, matchLen, offset, b, i;
+
+    while (ip < end) {
+        token = *ip++;
+        litLen = token >> 4;
+        if (litLen == 15) {
+            do {
+                if (ip >= end)
+                    return -1;
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if (litLen > end - ip || litLen > oend - op)
+            return -1;
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+        if (ip == end) /* the last sequence has no match */
+            break;
+
+        if (end - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        matchLen = token & 15;
+        if (matchLen == 15) {
+            do {
+                if (ip >= end)
+                    return -1;
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += SD_MINMATCH;
+        if (offset == 0 || offset > op - dst || matchLen > oend - op)
+            return -1;
+        for (i = 0; i < matchLen; i++) /* the match may overlap what it makes */
+            op[i] = op[i - offset];
+        op += matchLen;
+    }
+    return (op == oend) ? 0 : -1;
+} /* !SD_decompress */
+
+/*
+ * SD_loadCompressed: Read the rest of an image saved by
+ *   SD_saveDiskCompressed, its header already read; the sectors it
+ *   doesn't have are zero
+ *
+ * Parameters: the open image file and its header
+ *
+ * Returns: 0 if OK, -1 otherwise
+ *
+ */
+static int SD_loadCompressed(FILE* diskFile, ImageHeader* header) {
+    static unsigned char chunk[SD_CHUNKSECTORS * SD_SECTORSIZE];
+    static unsigned char packed[SD_CHUNKSECTORS * SD_SECTORSIZE];
+    unsigned char present[(SD_NUMSECTORS + 7) / 8];
+    int i, first, count, len;
+
+    if ((*header).numSectors != SD_NUMSECTORS || (*header).sectorSize != SD_SECTORSIZE
+            || (*header).chunkSectors != SD_CHUNKSECTORS)
+        return -1;
+    if (fread(present, sizeof(present), 1, diskFile) != 1)
+        return -1;
+
+    memset(disk, 0, sizeof(Sector) * SD_NUMSECTORS);
+    for (first = 0; first < SD_NUMSECTORS; first += SD_CHUNKSECTORS) {
+        for (i = first, count = 0; i < first + SD_CHUNKSECTORS && i < SD_NUMSECTORS; i++)
+            if (present[i / 8] & (1 << (i % 8)))
+                count++;
+        if (count == 0)
+            continue;
+        if (fread(&len, sizeof(len), 1, diskFile) != 1 || len <= 0 || len > count * SD_SECTORSIZE
+                || fread(packed, len, 1, diskFile) != 1)
+            return -1;
+        if (len == count * SD_SECTORSIZE) /* stored as it was */
+            memcpy(chunk, packed, len);
+        else if (SD_decompress(packed, len, chunk, count * SD_SECTORSIZE))
+            return -1;
+        for (i = first, count = 0; i < first + SD_CHUNKSECTORS && i < SD_NUMSECTORS; i++)
+            if (present[i / 8] & (1 << (i % 8)))
+                memcpy(disk + i, chunk + count++ * SD_SECTORSIZE, sizeof(Sector));
+    }
+    return 0;
+} /* !SD_loadCompressed */